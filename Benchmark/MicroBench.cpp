@@ -0,0 +1,858 @@
+//
+//  MicroBench.cpp
+//  Benchmark
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <functional>
+#include <unistd.h>
+#include "ARDrone.h"
+#include "ARVideoService.h"
+#include "ARChecksum.h"
+
+// Micro benchmarks for the hot paths of the library. Every benchmark reports the best of
+// five samples in ns/op together with the heap allocations and bytes allocated per op.
+//
+//   ARDroneBench [filter] [capture]
+//
+// Only benchmarks whose name contains the filter are run. Given a capture from
+// Drone::StartCapture(), its navdata is parsed as well.
+
+static std::atomic<uint64_t> __allocations(0);
+static std::atomic<uint64_t> __allocatedBytes(0);
+
+static void *CountedAllocate(size_t size)
+{
+	__allocations.fetch_add(1, std::memory_order_relaxed);
+	__allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	
+	void *result = malloc(size ? size : 1);
+	if(!result)
+		throw std::bad_alloc();
+	
+	return result;
+}
+
+void *operator new(size_t size)
+{
+	return CountedAllocate(size);
+}
+void *operator new[](size_t size)
+{
+	return CountedAllocate(size);
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	__allocations.fetch_add(1, std::memory_order_relaxed);
+	__allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	
+	return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+void *operator new(size_t size, std::align_val_t alignment)
+{
+	__allocations.fetch_add(1, std::memory_order_relaxed);
+	__allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	
+	void *result = aligned_alloc(static_cast<size_t>(alignment), (size + static_cast<size_t>(alignment) - 1) & ~(static_cast<size_t>(alignment) - 1));
+	if(!result)
+		throw std::bad_alloc();
+	
+	return result;
+}
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+void operator delete(void *pointer) noexcept
+{
+	free(pointer);
+}
+void operator delete[](void *pointer) noexcept
+{
+	free(pointer);
+}
+void operator delete(void *pointer, size_t) noexcept
+{
+	free(pointer);
+}
+void operator delete[](void *pointer, size_t) noexcept
+{
+	free(pointer);
+}
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+	free(pointer);
+}
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+	free(pointer);
+}
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+	free(pointer);
+}
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+	free(pointer);
+}
+
+namespace AR
+{
+	class Benchmark
+	{
+	public:
+		typedef std::function<void ()> Function;
+		
+		Benchmark(const char *filter) :
+			_filter(filter)
+		{}
+		
+		void Run(const char *name, const Function &function)
+		{
+			if(_filter && !strstr(name, _filter))
+				return;
+			
+			// Warm up while looking for an iteration count that runs for at least 50ms
+			uint64_t iterations = 1;
+			
+			while(1)
+			{
+				auto start = std::chrono::steady_clock::now();
+				
+				for(uint64_t i = 0; i < iterations; i ++)
+					function();
+				
+				if(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50) || iterations >= (UINT64_C(1) << 30))
+					break;
+				
+				iterations *= 2;
+			}
+			
+			double best = std::numeric_limits<double>::max();
+			uint64_t allocations = 0;
+			uint64_t bytes = 0;
+			
+			for(int sample = 0; sample < 5; sample ++)
+			{
+				uint64_t allocationsBefore = __allocations.load();
+				uint64_t bytesBefore = __allocatedBytes.load();
+				
+				auto start = std::chrono::steady_clock::now();
+				
+				for(uint64_t i = 0; i < iterations; i ++)
+					function();
+				
+				double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+				
+				best = std::min(best, elapsed / iterations);
+				allocations = __allocations.load() - allocationsBefore;
+				bytes = __allocatedBytes.load() - bytesBefore;
+			}
+			
+			std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+				<< std::setw(12) << iterations << " ops"
+				<< std::setw(12) << std::setprecision(1) << best << " ns/op"
+				<< std::setw(10) << std::setprecision(2) << (static_cast<double>(allocations) / iterations) << " allocs/op"
+				<< std::setw(12) << std::setprecision(1) << (static_cast<double>(bytes) / iterations) << " B/op" << std::endl;
+		}
+		
+		// Runs function until any pools are warm and then fails if it still allocates
+		bool CheckAllocations(const char *name, uint64_t iterations, const Function &function)
+		{
+			if(_filter && !strstr(name, _filter))
+				return true;
+			
+			for(uint64_t i = 0; i < iterations; i ++)
+				function();
+			
+			uint64_t allocationsBefore = __allocations.load();
+			
+			for(uint64_t i = 0; i < iterations; i ++)
+				function();
+			
+			uint64_t allocations = __allocations.load() - allocationsBefore;
+			
+			std::cout << std::left << std::setw(28) << name << std::right
+				<< std::setw(12) << iterations << " ops"
+				<< std::setw(12) << allocations << " allocs"
+				<< (allocations ? "      FAILED" : "      ok") << std::endl;
+			
+			return (allocations == 0);
+		}
+		
+		// Runs function on every producer thread at once, while background is called in a loop on one more thread.
+		// Reports the wall time per operation over all producers, best of five samples
+		void RunConcurrent(const char *name, size_t producers, uint64_t iterations, const std::function<void (size_t)> &function, const Function &background)
+		{
+			if(_filter && !strstr(name, _filter))
+				return;
+			
+			double best = std::numeric_limits<double>::max();
+			uint64_t allocations = 0;
+			uint64_t bytes = 0;
+			
+			for(int sample = 0; sample < 5; sample ++)
+			{
+				std::atomic<bool> running(true);
+				std::atomic<size_t> ready(0);
+				std::atomic<bool> go(false);
+				
+				std::thread consumer([&] {
+					while(running.load(std::memory_order_relaxed))
+						background();
+					
+					background();
+				});
+				
+				std::vector<std::thread> threads;
+				
+				for(size_t i = 0; i < producers; i ++)
+				{
+					threads.emplace_back([&, i] {
+						ready.fetch_add(1);
+						
+						while(!go.load())
+						{}
+						
+						for(uint64_t j = 0; j < iterations; j ++)
+							function(i);
+					});
+				}
+				
+				while(ready.load() != producers)
+				{}
+				
+				uint64_t allocationsBefore = __allocations.load();
+				uint64_t bytesBefore = __allocatedBytes.load();
+				
+				auto start = std::chrono::steady_clock::now();
+				go = true;
+				
+				for(std::thread &thread : threads)
+					thread.join();
+				
+				double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+				
+				allocations = __allocations.load() - allocationsBefore;
+				bytes = __allocatedBytes.load() - bytesBefore;
+				
+				running = false;
+				consumer.join();
+				
+				best = std::min(best, elapsed / (iterations * producers));
+			}
+			
+			uint64_t operations = iterations * producers;
+			
+			std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+				<< std::setw(12) << operations << " ops"
+				<< std::setw(12) << std::setprecision(1) << best << " ns/op"
+				<< std::setw(10) << std::setprecision(2) << (static_cast<double>(allocations) / operations) << " allocs/op"
+				<< std::setw(12) << std::setprecision(1) << (static_cast<double>(bytes) / operations) << " B/op" << std::endl;
+		}
+		
+		// Runs function on every producer thread, all threads start each iteration together.
+		// Fails if function returned false for any of them
+		bool CheckConcurrent(const char *name, size_t producers, uint64_t iterations, const std::function<bool (size_t, uint64_t)> &function)
+		{
+			if(_filter && !strstr(name, _filter))
+				return true;
+			
+			std::atomic<uint64_t> arrived(0);
+			std::atomic<uint64_t> failures(0);
+			std::vector<std::thread> threads;
+			
+			for(size_t i = 0; i < producers; i ++)
+			{
+				threads.emplace_back([&, i] {
+					for(uint64_t j = 0; j < iterations; j ++)
+					{
+						arrived.fetch_add(1);
+						
+						while(arrived.load() < (j + 1) * producers)
+							std::this_thread::yield();
+						
+						if(!function(i, j))
+							failures.fetch_add(1);
+					}
+				});
+			}
+			
+			for(std::thread &thread : threads)
+				thread.join();
+			
+			std::cout << std::left << std::setw(28) << name << std::right
+				<< std::setw(12) << (iterations * producers) << " ops"
+				<< std::setw(12) << failures.load() << " failed"
+				<< (failures.load() ? "      FAILED" : "      ok") << std::endl;
+			
+			return (failures.load() == 0);
+		}
+		
+		// Access to the internals of the services
+		static void FlushCommands(ATService *service)
+		{
+			service->Tick(Service::WakeupReason::DataAvilable);
+		}
+		
+		static Navdata *ParseNavdata(NavdataService *service, const std::vector<uint8_t> &packet)
+		{
+			service->_sequence = 0;
+			return service->ParseNavdata(packet.data(), packet.size(), std::chrono::steady_clock::now());
+		}
+		
+		// Parses the packet in place like the service does in view mode
+		static Navdata *ParseNavdataView(NavdataService *service, const std::vector<uint8_t> &packet)
+		{
+			NavdataBuffer *buffer = service->_buffers[0];
+			memcpy(buffer->GetData(), packet.data(), packet.size());
+			
+			service->_sequence = 0;
+			return service->ParseNavdata(buffer->GetData(), packet.size(), std::chrono::steady_clock::now(), buffer);
+		}
+		
+		// A packet through the whole view mode receive path, from the pooled buffer to the drone
+		static Navdata *ReceiveNavdata(NavdataService *service, const std::vector<uint8_t> &packet)
+		{
+			Navdata *result = ParseNavdataView(service, packet);
+			
+			if(result)
+			{
+				service->_buffers[0]->Release();
+				service->_buffers[0] = service->_pool->Acquire();
+				
+				service->GetDrone()->PublishNavdata(result);
+			}
+			
+			return result;
+		}
+		
+		static void ResetState(NavdataService *service)
+		{
+			service->SetState(Service::State::Disconnected);
+		}
+		
+		static void RecordArrival(NavdataService *service, const std::vector<uint8_t> &packet)
+		{
+			service->RecordArrival(packet.data(), packet.size(), std::chrono::steady_clock::now());
+		}
+		
+		static void SetState(Drone *drone, Drone::State state)
+		{
+			drone->_state = state;
+		}
+		
+		static void DispatchNavdata(Drone *drone, Navdata *navdata)
+		{
+			drone->DispatchNavdata(navdata);
+		}
+		
+		static void LoadVideo(VideoService *service, const std::vector<uint8_t> &data)
+		{
+			std::copy(data.begin(), data.end(), service->_buffer);
+			service->_bufferOffset = data.size();
+		}
+		
+		static size_t FindPaveHeader(VideoService *service)
+		{
+			return service->FindPaveHeader(0);
+		}
+		
+		static void PushVideo(VideoService *service, const std::vector<uint8_t> &data)
+		{
+			VideoService::Chunk chunk;
+			chunk.data = data;
+			chunk.timestamp = std::chrono::steady_clock::now();
+			
+			service->_data.push_back(std::move(chunk));
+			service->Update();
+		}
+		
+		static size_t ParseConfig(ConfigService *service, const std::string &dump)
+		{
+			service->_config.clear();
+			service->_configBuffer.assign(dump);
+			service->ParseConfig();
+			
+			return service->_config.size();
+		}
+		
+	private:
+		const char *_filter;
+	};
+}
+
+static void Escape(void *pointer)
+{
+	asm volatile("" : : "g"(pointer) : "memory");
+}
+
+static size_t GetOptionSize(AR::NavdataTag tag)
+{
+	switch(tag)
+	{
+#define OptionSize(name) case AR::NavdataTag::name: return sizeof(AR::NavdataOption##name);
+		OptionSize(Demo)
+		OptionSize(Time)
+		OptionSize(RawMeasures)
+		OptionSize(PhysMeasures)
+		OptionSize(GyrosOffsets)
+		OptionSize(EulerAngles)
+		OptionSize(References)
+		OptionSize(Trims)
+		OptionSize(RCReferences)
+		OptionSize(PWM)
+		OptionSize(Altitude)
+		OptionSize(VisionRaw)
+		OptionSize(Vision)
+		OptionSize(VisionPerf)
+		OptionSize(ADCDataFrame)
+		OptionSize(PressureRaw)
+		OptionSize(Magneto)
+		OptionSize(Wind)
+		OptionSize(KalmanPressure)
+		OptionSize(Wifi)
+		OptionSize(GPS)
+#undef OptionSize
+		default:
+			return 0;
+	}
+}
+
+// A navdata packet with every option the drone sends outside of demo mode
+static std::vector<uint8_t> MakeNavdataPacket()
+{
+	std::vector<uint8_t> packet(16);
+	
+	uint32_t header[4] = { 0x55667788, 0, 1, 0 };
+	memcpy(packet.data(), header, sizeof(header));
+	
+	for(uint16_t tag = 0; tag < 28; tag ++)
+	{
+		size_t size = GetOptionSize(static_cast<AR::NavdataTag>(tag));
+		if(size == 0)
+			continue;
+		
+		size_t offset = packet.size();
+		packet.resize(offset + size);
+		
+		for(size_t i = sizeof(AR::NavdataOption); i < size; i ++)
+			packet[offset + i] = static_cast<uint8_t>(i * 13);
+		
+		AR::NavdataOption option = { static_cast<AR::NavdataTag>(tag), static_cast<uint16_t>(size) };
+		memcpy(packet.data() + offset, &option, sizeof(option));
+	}
+	
+	uint32_t checksum = 0;
+	for(uint8_t byte : packet)
+		checksum += byte;
+	
+	AR::NavdataOptionChecksum option;
+	option.tag  = AR::NavdataTag::Checksum;
+	option.size = sizeof(AR::NavdataOptionChecksum);
+	option.checksum = checksum;
+	
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&option);
+	packet.insert(packet.end(), bytes, bytes + sizeof(option));
+	
+	return packet;
+}
+
+static std::vector<uint8_t> MakeVideoFrame(uint32_t number, size_t payload)
+{
+	std::vector<uint8_t> frame(sizeof(AR::PAVE) + payload);
+	AR::PAVE *pave = reinterpret_cast<AR::PAVE *>(frame.data());
+	
+	memcpy(pave->signature, "PaVE", 4);
+	pave->header_size  = sizeof(AR::PAVE);
+	pave->payload_size = static_cast<uint32_t>(payload);
+	pave->frame_number = number;
+	pave->frame_type   = (number % 30 == 0) ? AR::PAVEFrameTypeIFrame : AR::PAVEFrameTypePFrame;
+	pave->control      = AR::PAVEControlTypeData;
+	
+	for(size_t i = sizeof(AR::PAVE); i < frame.size(); i ++)
+		frame[i] = static_cast<uint8_t>((i * 7) & 0x3f);
+	
+	return frame;
+}
+
+// Every navdata datagram the drone sent in the capture, in the order they arrived
+static std::vector<std::vector<uint8_t>> LoadCapturedNavdata(const char *path)
+{
+	std::vector<std::vector<uint8_t>> packets;
+	AR::Replay replay;
+	
+	if(!replay.Open(path, false))
+		return packets;
+	
+	uint8_t buffer[AR::NavdataBuffer::kSize];
+	size_t length;
+	
+	while(replay.Read(5554, false, buffer, sizeof(buffer), &length, false, std::chrono::milliseconds(0)) == AR::Socket::Result::Success)
+		packets.emplace_back(buffer, buffer + length);
+	
+	return packets;
+}
+
+// Roughly the size and shape of the dump an AR.Drone 2.0 sends on port 5559
+static std::string MakeConfigDump()
+{
+	const char *sections[] = { "general", "control", "network", "pic", "video", "leds", "detect", "syslog", "userbox", "gps", "custom" };
+	std::string dump;
+	
+	for(size_t i = 0; dump.size() < 30 * 1024; i ++)
+	{
+		dump.append(sections[i % 11]);
+		dump.append(":setting_");
+		dump.append(std::to_string(i));
+		dump.append(" = ");
+		dump.append((i % 3 == 0) ? "{ -2.0000000e+03 2.0000000e+03 2.0000000e+03 }" : std::to_string(i * 7919));
+		dump.append("\n");
+	}
+	
+	return dump;
+}
+
+int main(int argc, const char *argv[])
+{
+	AR::Benchmark benchmark((argc > 1) ? argv[1] : nullptr);
+	
+	AR::Drone *drone = new AR::Drone("127.0.0.1");
+	AR::VideoService *video = drone->AddService<AR::VideoService>();
+	AR::NavdataService *navdata = drone->GetService<AR::NavdataService>("Navdata");
+	AR::ConfigService *config = drone->GetService<AR::ConfigService>("Config");
+	
+	
+	benchmark.Run("ATCommand", [] {
+		AR::ATCommand command("PCMD");
+		command << 1 << 0.25f << -0.5f << 0.0f << 0.125f;
+		
+		Escape(&command);
+	});
+	
+	AR::ATCommand command("PCMD");
+	command << 1 << 0.25f << -0.5f << 0.0f << 0.125f;
+	
+	uint32_t sequence = 1;
+	
+	benchmark.Run("ATCommand::GetCommand", [&] {
+		std::string string = command.GetCommand(sequence ++);
+		Escape(&string);
+	});
+	
+	char encoded[AR::ATCommand::kMaxLength + 1];
+	
+	benchmark.Run("ATCommand::Encode", [&] {
+		size_t length = command.Encode(sequence ++, encoded);
+		Escape(&length);
+		Escape(encoded);
+	});
+	
+	benchmark.Run("AT::PCMD::Encode", [&] {
+		size_t length = AR::AT::PCMD.Encode(sequence ++, encoded, 1, 0.25f, -0.5f, 0.0f, 0.125f);
+		Escape(&length);
+		Escape(encoded);
+	});
+	
+	
+	// Producers hammering the AT queue while the service flushes it, the socket isn't connected so sends fail right away
+	AR::ATService *at = drone->GetService<AR::ATService>("AT");
+	
+	for(size_t producers : { 1, 4, 8, 16 })
+	{
+		std::string name = "ATService::Send/" + std::to_string(producers);
+		
+		benchmark.RunConcurrent(name.c_str(), producers, 200000 / producers, [&](size_t thread) {
+			at->Send(AR::AT::PCMD, 1, 0.25f, -0.5f, static_cast<float>(thread), 0.125f);
+			at->Send(AR::AT::CTRL, 5, 0);
+		}, [&] {
+			AR::Benchmark::FlushCommands(at);
+		});
+	}
+	
+	// Every producer sends one command and waits for it to show up on the wire. The AT service has no
+	// tick interval, so a lost wakeup leaves the command in the queue until something else is sent
+	bool transmitted = true;
+	int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+	
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(5556);
+	
+	if(bind(receiver, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+		std::cout << "Port 5556 is in use, skipping ATService::Send/delivery" << std::endl;
+	else
+	{
+		const size_t producers = 4;
+		
+		AR::Drone *remote = new AR::Drone("127.0.0.1");
+		AR::ATService *service = remote->GetService<AR::ATService>("AT");
+		
+		AR::Socket::Options options = service->GetSocketOptions();
+		options.localPort = 0;
+		
+		service->SetSocketOptions(options);
+		service->Connect();
+		
+		struct timeval timeout = { 0, 50000 };
+		setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		
+		std::vector<std::atomic<uint64_t>> arrived(producers);
+		std::atomic<bool> listening(true);
+		
+		std::thread listener([&] {
+			char datagram[2048];
+			
+			while(listening.load())
+			{
+				ssize_t length = recv(receiver, datagram, sizeof(datagram) - 1, 0);
+				if(length <= 0)
+					continue;
+				
+				datagram[length] = '\0';
+				
+				for(char *command = strstr(datagram, "AT*CTRL="); command; command = strstr(command + 1, "AT*CTRL="))
+				{
+					unsigned int round, thread;
+					
+					if(sscanf(command, "AT*CTRL=%*u,%u,%u", &round, &thread) == 2 && thread < producers)
+						arrived[thread].store(round);
+				}
+			}
+		});
+		
+		transmitted = benchmark.CheckConcurrent("ATService::Send/delivery", producers, 5000, [&](size_t thread, uint64_t round) {
+			service->Send(AR::AT::CTRL, static_cast<int>(round + 1), static_cast<int>(thread));
+			
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+			
+			while(arrived[thread].load() != round + 1)
+			{
+				if(std::chrono::steady_clock::now() >= deadline)
+					return false;
+				
+				std::this_thread::yield();
+			}
+			
+			return true;
+		});
+		
+		listening = false;
+		listener.join();
+		
+		service->Disconnect();
+		delete remote;
+	}
+	
+	close(receiver);
+	
+	
+	std::vector<uint8_t> packet = MakeNavdataPacket();
+	
+	benchmark.Run("NavdataService::Parse", [&] {
+		AR::Navdata *result = AR::Benchmark::ParseNavdata(navdata, packet);
+		Escape(result);
+		
+		result->Release();
+	});
+	
+	benchmark.Run("NavdataService::ParseView", [&] {
+		AR::Navdata *result = AR::Benchmark::ParseNavdataView(navdata, packet);
+		Escape(result);
+		
+		result->Release();
+	});
+	
+	// Subscribers that hold on to the last few packets
+	AR::NavdataRef retained[4];
+	size_t received = 0;
+	
+	bool steady = benchmark.CheckAllocations("NavdataService::Receive", 10000, [&] {
+		AR::Navdata *result = AR::Benchmark::ReceiveNavdata(navdata, packet);
+		retained[received ++ % 4] = AR::NavdataRef(result);
+	});
+	
+	for(AR::NavdataRef &navdata : retained)
+		navdata = AR::NavdataRef();
+	
+	// Every eighth packet goes missing, so the loss bookkeeping is part of it
+	std::vector<uint8_t> arrival = packet;
+	uint32_t arrivalSequence = 1;
+	
+	benchmark.Run("NavdataService::RecordArrival", [&] {
+		arrivalSequence += ((arrivalSequence & 7) == 7) ? 2 : 1;
+		memcpy(arrival.data() + 8, &arrivalSequence, sizeof(arrivalSequence));
+		
+		AR::Benchmark::RecordArrival(navdata, arrival);
+	});
+	
+	// Real traffic goes straight into the parser. A drone connected to a replay can't run faster
+	// than real time, the config handshake would fall behind the navdata
+	if(argc > 2)
+	{
+		std::vector<std::vector<uint8_t>> captured = LoadCapturedNavdata(argv[2]);
+		size_t next = 0;
+		
+		if(captured.empty())
+			std::cout << "No navdata in " << argv[2] << std::endl;
+		else
+		{
+			benchmark.Run("NavdataService::Parse/capture", [&] {
+				AR::Navdata *result = AR::Benchmark::ParseNavdata(navdata, captured[next]);
+				Escape(result);
+				
+				if(result)
+					result->Release();
+				
+				next = (next + 1) % captured.size();
+			});
+		}
+	}
+	
+	// Every kernel has to agree with the scalar one on all lengths and alignments
+	bool checksums = true;
+	
+	for(AR::Checksum::Kernel kernel : { AR::Checksum::Kernel::Scalar, AR::Checksum::Kernel::SSE2, AR::Checksum::Kernel::AVX2 })
+	{
+		if(!AR::Checksum::IsSupported(kernel))
+			continue;
+		
+		for(size_t offset = 0; offset < 32; offset ++)
+		{
+			for(size_t length = 0; offset + length <= packet.size(); length += 7)
+			{
+				uint32_t expected = AR::Checksum::Sum(AR::Checksum::Kernel::Scalar, packet.data() + offset, length);
+				
+				if(AR::Checksum::Sum(kernel, packet.data() + offset, length) != expected)
+					checksums = false;
+			}
+		}
+		
+		std::string name = std::string("Checksum::Sum/") + AR::Checksum::GetKernelName(kernel);
+		
+		// The full packet minus the checksum option, which is what the drone sums up
+		benchmark.Run(name.c_str(), [&] {
+			uint32_t checksum = AR::Checksum::Sum(kernel, packet.data(), packet.size() - sizeof(AR::NavdataOptionChecksum));
+			Escape(&checksum);
+		});
+	}
+	
+	if(!checksums)
+		std::cout << "Checksum kernels disagree with the scalar sum" << std::endl;
+	
+	AR::Navdata *parsed = AR::Benchmark::ParseNavdata(navdata, packet);
+	AR::Benchmark::ResetState(navdata);
+	
+	benchmark.Run("Navdata::CopyWithTags", [&] {
+		AR::Navdata *copy = parsed->CopyWithTags(AR::NavdataOptions(AR::NavdataTag::Demo, AR::NavdataTag::Time, AR::NavdataTag::Magneto));
+		Escape(copy);
+		
+		delete copy;
+	});
+	
+	benchmark.Run("Navdata::GetOptionWithTag", [&] {
+		AR::NavdataOptionGPS *gps = parsed->GetOptionWithTag<AR::NavdataOptionGPS>(AR::NavdataTag::GPS);
+		Escape(gps);
+	});
+	
+	uint32_t wanted = AR::NavdataOptions(AR::NavdataTag::Demo, AR::NavdataTag::GPS, AR::NavdataTag::Magneto);
+	
+	benchmark.Run("Navdata::HasOptions", [&] {
+		bool result = parsed->HasOptions(wanted);
+		Escape(&result);
+	});
+	
+	
+	// Subscribers are only called once connected
+	std::atomic<uint64_t> delivered(0);
+	char tokens[32];
+	
+	AR::Benchmark::SetState(drone, AR::Drone::State::Connected);
+	
+	for(size_t i = 0; i < 32; i ++)
+	{
+		drone->AddNavdataSubscriber([&](AR::Navdata *) {
+			delivered.fetch_add(1, std::memory_order_relaxed);
+		}, &tokens[i]);
+	}
+	
+	benchmark.Run("Drone::DispatchNavdata/32", [&] {
+		AR::Benchmark::DispatchNavdata(drone, parsed);
+	});
+	
+	// Another thread keeps changing the subscribers and taking the drone lock while packets are dispatched
+	int churn;
+	
+	benchmark.RunConcurrent("Drone::DispatchNavdata/32+churn", 1, 100000, [&](size_t) {
+		AR::Benchmark::DispatchNavdata(drone, parsed);
+	}, [&] {
+		drone->AddNavdataSubscriber([](AR::Navdata *) {}, &churn);
+		drone->RemoveNavdataSubscriber(&churn);
+		drone->SetNavdataOptions(0);
+	});
+	
+	for(size_t i = 0; i < 32; i ++)
+		drone->RemoveNavdataSubscriber(&tokens[i]);
+	
+	AR::Benchmark::SetState(drone, AR::Drone::State::Disconnected);
+	parsed->Release();
+	
+	
+	// A 64 KB stretch of payload with the next header right at the end
+	std::vector<uint8_t> search = MakeVideoFrame(0, 64 * 1024);
+	std::vector<uint8_t> next = MakeVideoFrame(1, 0);
+	
+	memset(search.data(), 0, 4);
+	search.insert(search.end(), next.begin(), next.end());
+	
+	AR::Benchmark::LoadVideo(video, search);
+	
+	benchmark.Run("VideoService::FindPaveHeader", [&] {
+		size_t offset = AR::Benchmark::FindPaveHeader(video);
+		Escape(&offset);
+	});
+	
+	std::vector<uint8_t> frame = MakeVideoFrame(0, 16 * 1024);
+	
+	benchmark.Run("VideoService::Update", [&] {
+		AR::Benchmark::PushVideo(video, frame);
+	});
+	
+	
+	std::string dump = MakeConfigDump();
+	
+	benchmark.Run("ConfigService::ParseConfig", [&] {
+		size_t count = AR::Benchmark::ParseConfig(config, dump);
+		Escape(&count);
+	});
+	
+	delete drone;
+	return (steady && checksums && transmitted) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
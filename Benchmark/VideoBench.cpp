@@ -0,0 +1,176 @@
+//
+//  VideoBench.cpp
+//  Benchmark
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+#include "ARSocket.h"
+#include "ARURingReceiver.h"
+
+// Streams a fixed amount of data over loopback TCP, the same way the drone pushes its video
+// on port 5555, and compares the plain recv() loop of the VideoService with the io_uring one.
+
+struct Result
+{
+	size_t bytes;
+	uint64_t syscalls;
+	double seconds;
+};
+
+static int CreateListener(uint16_t *port)
+{
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+	
+	socklen_t length = sizeof(address);
+	
+	if(bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0)
+	{
+		close(listener);
+		return -1;
+	}
+	
+	getsockname(listener, reinterpret_cast<struct sockaddr *>(&address), &length);
+	*port = ntohs(address.sin_port);
+	
+	return listener;
+}
+
+static void Stream(int listener, size_t total)
+{
+	int connection = accept(listener, nullptr, nullptr);
+	std::vector<uint8_t> data(65536, 0xaa);
+	
+	while(total > 0)
+	{
+		ssize_t written = write(connection, data.data(), std::min(total, data.size()));
+		if(written <= 0)
+			break;
+		
+		total -= written;
+	}
+	
+	close(connection);
+}
+
+template<class F>
+static Result Run(size_t total, F &&receive)
+{
+	uint16_t port;
+	int listener = CreateListener(&port);
+	
+	if(listener == -1)
+	{
+		std::cerr << "Failed to create the loopback listener" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	std::thread sender(&Stream, listener, total);
+	
+	AR::Socket socket("127.0.0.1", port, AR::Socket::Type::TCP);
+	socket.Connect();
+	
+	Result result = {};
+	
+	auto start = std::chrono::steady_clock::now();
+	receive(socket, result);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	sender.join();
+	close(listener);
+	
+	return result;
+}
+
+static void Print(const char *name, const Result &result)
+{
+	double megabytes = result.bytes / (1024.0 * 1024.0);
+	
+	std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(10) << (megabytes / result.seconds) << " MB/s"
+		<< std::setw(10) << result.syscalls << " syscalls"
+		<< std::setw(10) << (result.syscalls / megabytes) << " syscalls/MB" << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t megabytes = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 256;
+	size_t total = megabytes * 1024 * 1024;
+	
+	Result plain = Run(total, [](AR::Socket &socket, Result &result) {
+		
+		// One allocation and one recv() per chunk, just like VideoService::Tick() without io_uring
+		while(1)
+		{
+			std::vector<uint8_t> chunk(32768);
+			size_t read = 0;
+			
+			AR::Socket::Result status = socket.Receive(chunk.data(), chunk.size(), &read);
+			result.syscalls ++;
+			
+			if(status != AR::Socket::Result::Success)
+				break;
+			
+			result.bytes += read;
+		}
+		
+	});
+	
+	Print("recv", plain);
+	
+	if(!AR::URingReceiver::IsSupported())
+	{
+		std::cout << "io_uring     not supported by this build or kernel" << std::endl;
+		return EXIT_SUCCESS;
+	}
+	
+	Result uring = Run(total, [](AR::Socket &socket, Result &result) {
+		
+		AR::URingReceiver receiver;
+		receiver.Start(socket.GetDescriptor());
+		
+		while(1)
+		{
+			std::vector<uint8_t> chunk;
+			
+			AR::Socket::Result status = receiver.Receive([&](const uint8_t *data, size_t length) {
+				chunk.insert(chunk.end(), data, data + length);
+			}, std::chrono::seconds(2));
+			
+			result.bytes += chunk.size();
+			
+			if(status != AR::Socket::Result::Success)
+				break;
+		}
+		
+		result.syscalls = receiver.GetEnterCount();
+		receiver.Stop();
+		
+	});
+	
+	Print("io_uring", uring);
+	
+	return EXIT_SUCCESS;
+}
@@ -29,7 +29,7 @@ int main(int argc, const char * argv[])
 		if(demo)
 			std::cout << "Battery: " << demo->vbat_flying_percentage << std::endl;
 		
-	}, nullptr);
+	}, nullptr, AR::NavdataOptions(AR::NavdataTag::Demo), std::chrono::seconds(1));
 	
 	
 	
@@ -0,0 +1,840 @@
+//
+//  DroneSim.cpp
+//  Simulator
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "ARNavdataOptions.h"
+#include "ARVideoService.h"
+
+// Pretends to be an AR.Drone 2.0 on a local address, so the library can be exercised and
+// load tested without hardware. Bind it to a different loopback address than the client,
+// eg. 127.0.0.2, since the client binds the same UDP ports on every interface. The client
+// then has to set Socket::Options::reuseAddress on its AT and navdata sockets or bind
+// ephemeral ports, DroneFleet does the former.
+//
+//   DroneSim [--address 127.0.0.2] [--navdata-rate 200] [--navdata-loss 0] [--navdata-reorder 0]
+//            [--video file.pave] [--video-fps 30] [--frame-size 16384] [--config dump.txt] [--quiet]
+//
+// A navdata or video rate of 0 sends as fast as the socket allows. Loss and reorder are the percent
+// of navdata packets that are dropped, or held back and sent after the next one, which shows up in
+// NavdataService::GetStatistics().
+
+namespace
+{
+	enum
+	{
+		kPortNavdata = 5554,
+		kPortVideo   = 5555,
+		kPortAT      = 5556,
+		kPortControl = 5559
+	};
+	
+	enum
+	{
+		kControlConfigGet = 4,
+		kControlAck = 5
+	};
+	
+	struct NavdataHeader
+	{
+		uint32_t header;
+		uint32_t state;
+		uint32_t sequence;
+		int32_t vision;
+	} __attribute__((packed));
+	
+	struct Settings
+	{
+		Settings() :
+			address("127.0.0.2"),
+			navdataRate(200),
+			navdataLoss(0),
+			navdataReorder(0),
+			videoRate(30),
+			frameSize(16384),
+			quiet(false)
+		{}
+		
+		std::string address;
+		std::string videoFile;
+		std::string configFile;
+		
+		uint32_t navdataRate;
+		uint32_t navdataLoss; // Percent of packets that are never sent
+		uint32_t navdataReorder; // Percent of packets that are held back and sent after the next one
+		uint32_t videoRate;
+		uint32_t frameSize;
+		bool quiet;
+	};
+	
+	std::atomic<bool> _running(true);
+	
+	void HandleSignal(int)
+	{
+		_running = false;
+	}
+	
+	
+	class Simulator
+	{
+	public:
+		Simulator(const Settings &settings) :
+			_settings(settings),
+			_state(AR::ARDRONE_NAVDATA_BOOTSTRAP | AR::ARDRONE_NAVDATA_THREAD_ON | AR::ARDRONE_ATCODEC_THREAD_ON | AR::ARDRONE_VIDEO_THREAD_ON),
+			_options(1 << static_cast<uint32_t>(AR::NavdataTag::Demo)),
+			_control(-1),
+			_commands(0),
+			_navdataPackets(0),
+			_videoBytes(0)
+		{
+			LoadConfig();
+		}
+		
+		bool Run()
+		{
+			int navdata = OpenSocket(SOCK_DGRAM, kPortNavdata);
+			int at      = OpenSocket(SOCK_DGRAM, kPortAT);
+			int video   = OpenSocket(SOCK_STREAM, kPortVideo);
+			int control = OpenSocket(SOCK_STREAM, kPortControl);
+			
+			if(navdata == -1 || at == -1 || video == -1 || control == -1)
+			{
+				std::cerr << "Failed to bind to " << _settings.address << ": " << strerror(errno) << std::endl;
+				return false;
+			}
+			
+			std::cout << "Simulating a drone on " << _settings.address << std::endl;
+			
+			std::thread navdataThread(&Simulator::NavdataThread, this, navdata);
+			std::thread atThread(&Simulator::ATThread, this, at);
+			std::thread videoThread(&Simulator::VideoThread, this, video);
+			std::thread controlThread(&Simulator::ControlThread, this, control);
+			
+			while(_running)
+			{
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+				
+				uint64_t commands = _commands.exchange(0);
+				uint64_t packets  = _navdataPackets.exchange(0);
+				uint64_t bytes    = _videoBytes.exchange(0);
+				
+				if(!_settings.quiet)
+					std::cout << "AT: " << commands << " cmd/s, navdata: " << packets << " pkt/s, video: " << (bytes / 1024) << " KB/s" << std::endl;
+			}
+			
+			navdataThread.join();
+			atThread.join();
+			videoThread.join();
+			controlThread.join();
+			
+			close(navdata);
+			close(at);
+			close(video);
+			close(control);
+			
+			return true;
+		}
+		
+	private:
+		int OpenSocket(int type, uint16_t port)
+		{
+			int result = socket(AF_INET, type, 0);
+			if(result == -1)
+				return -1;
+			
+			int enable = 1;
+			setsockopt(result, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+			
+			int size = 4 * 1024 * 1024;
+			setsockopt(result, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int));
+			setsockopt(result, SOL_SOCKET, SO_SNDBUF, &size, sizeof(int));
+			
+			struct sockaddr_in address;
+			memset(&address, 0, sizeof(struct sockaddr_in));
+			
+			address.sin_family = AF_INET;
+			address.sin_port   = htons(port);
+			
+			if(inet_aton(_settings.address.c_str(), &address.sin_addr) == 0 ||
+			   bind(result, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1 ||
+			   (type == SOCK_STREAM && listen(result, 4) == -1))
+			{
+				close(result);
+				return -1;
+			}
+			
+			return result;
+		}
+		
+		// Waits for a client on a listening socket, giving up when the simulator shuts down
+		int Accept(int socket)
+		{
+			struct pollfd descriptor = { socket, POLLIN, 0 };
+			
+			while(_running)
+			{
+				if(poll(&descriptor, 1, 100) > 0)
+				{
+					int client = accept(socket, nullptr, nullptr);
+					if(client != -1)
+					{
+						int enable = 1;
+						setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+						
+						return client;
+					}
+				}
+			}
+			
+			return -1;
+		}
+		
+		static bool WriteAll(int socket, const uint8_t *data, size_t length)
+		{
+			while(length > 0)
+			{
+				ssize_t result = send(socket, data, length, MSG_NOSIGNAL);
+				if(result <= 0)
+					return false;
+				
+				data += result;
+				length -= result;
+			}
+			
+			return true;
+		}
+		
+		
+		void LoadConfig()
+		{
+			const char *defaults[][2] = {
+				{ "general:num_version_config", "1" },
+				{ "general:num_version_mb", "33" },
+				{ "general:num_version_soft", "2.4.8" },
+				{ "general:drone_serial", "XXXXXXXXXX" },
+				{ "general:soft_build_date", "2014-01-01 00:00" },
+				{ "general:motor1_soft", "1.41" },
+				{ "general:motor1_hard", "5.0" },
+				{ "general:motor1_supplier", "1.1" },
+				{ "general:ardrone_name", "DroneSim" },
+				{ "general:flying_time", "0" },
+				{ "general:navdata_demo", "FALSE" },
+				{ "general:navdata_options", "1" },
+				{ "general:com_watchdog", "2" },
+				{ "general:video_enable", "TRUE" },
+				{ "general:vision_enable", "TRUE" },
+				{ "general:vbat_min", "9000" },
+				{ "control:accs_offset", "{ -2.0000000e+03 2.0000000e+03 2.0000000e+03 }" },
+				{ "control:euler_angle_max", "2.0943952e-01" },
+				{ "control:altitude_max", "3000" },
+				{ "control:altitude_min", "50" },
+				{ "control:control_vz_max", "7.0000000e+02" },
+				{ "control:control_yaw", "1.7453293e+00" },
+				{ "control:outdoor", "FALSE" },
+				{ "control:flight_without_shell", "FALSE" },
+				{ "control:flying_mode", "0" },
+				{ "network:ssid_single_player", "ardrone2_sim" },
+				{ "network:wifi_mode", "0" },
+				{ "network:owner_mac", "00:00:00:00:00:00" },
+				{ "pic:ultrasound_freq", "8" },
+				{ "video:codec_fps", "30" },
+				{ "video:video_codec", "129" },
+				{ "video:video_channel", "0" },
+				{ "video:bitrate", "1000" },
+				{ "video:max_bitrate", "4000" },
+				{ "leds:leds_anim", "0,0,0" },
+				{ "detect:detect_type", "3" },
+				{ "syslog:output", "7" },
+				{ "custom:application_id", "00000000" },
+				{ "custom:profile_id", "00000000" },
+				{ "custom:session_id", "00000000" }
+			};
+			
+			for(auto &entry : defaults)
+				_config[entry[0]] = entry[1];
+			
+			if(_settings.configFile.empty())
+				return;
+			
+			// A dump in the same "key = value" format the drone sends
+			std::ifstream file(_settings.configFile);
+			std::string line;
+			
+			while(std::getline(file, line))
+			{
+				size_t separator = line.find(" = ");
+				if(separator != std::string::npos)
+					_config[line.substr(0, separator)] = line.substr(separator + 3);
+			}
+		}
+		
+		std::string DumpConfig()
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			std::string result;
+			
+			for(auto &entry : _config)
+			{
+				result.append(entry.first);
+				result.append(" = ");
+				result.append(entry.second);
+				result.append("\n");
+			}
+			
+			return result;
+		}
+		
+		
+		void ApplyConfig(const std::string &key, const std::string &value)
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_config[key] = value;
+			
+			if(key == "general:navdata_demo")
+			{
+				uint32_t state = _state.load();
+				
+				state &= ~AR::ARDRONE_NAVDATA_BOOTSTRAP;
+				state = (value == "TRUE") ? (state | AR::ARDRONE_NAVDATA_DEMO_MASK) : (state & ~AR::ARDRONE_NAVDATA_DEMO_MASK);
+				
+				_state = state;
+			}
+			
+			if(key == "general:navdata_options")
+				_options = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+			
+			_state |= AR::ARDRONE_COMMAND_MASK;
+		}
+		
+		void SendConfigDump()
+		{
+			std::string dump = DumpConfig();
+			dump.push_back('\0');
+			
+			std::lock_guard<std::mutex> lock(_lock);
+			
+			if(_control != -1)
+				WriteAll(_control, reinterpret_cast<const uint8_t *>(dump.data()), dump.size());
+		}
+		
+		// Splits "AT*NAME=seq,arg,"string",..." into its name and arguments, quotes removed
+		static bool ParseCommand(const char *begin, const char *end, std::string &name, std::vector<std::string> &arguments)
+		{
+			if(end - begin < 4 || strncmp(begin, "AT*", 3) != 0)
+				return false;
+			
+			const char *equal = static_cast<const char *>(memchr(begin, '=', end - begin));
+			if(!equal)
+				return false;
+			
+			name.assign(begin + 3, equal);
+			arguments.clear();
+			
+			const char *temp = equal + 1;
+			
+			while(temp < end)
+			{
+				std::string argument;
+				
+				if(*temp == '"')
+				{
+					const char *close = static_cast<const char *>(memchr(temp + 1, '"', end - temp - 1));
+					if(!close)
+						return false;
+					
+					argument.assign(temp + 1, close);
+					temp = close + 1;
+				}
+				else
+				{
+					const char *comma = static_cast<const char *>(memchr(temp, ',', end - temp));
+					argument.assign(temp, comma ? comma : end);
+					temp = comma ? comma : end;
+				}
+				
+				arguments.push_back(std::move(argument));
+				
+				if(temp < end && *temp == ',')
+					temp ++;
+			}
+			
+			return true;
+		}
+		
+		void HandleCommand(const std::string &name, const std::vector<std::string> &arguments)
+		{
+			_commands ++;
+			
+			if(name == "CONFIG" && arguments.size() >= 3)
+			{
+				ApplyConfig(arguments[1], arguments[2]);
+			}
+			else if(name == "CTRL" && arguments.size() >= 2)
+			{
+				int mode = atoi(arguments[1].c_str());
+				
+				if(mode == kControlAck)
+					_state &= ~AR::ARDRONE_COMMAND_MASK;
+				if(mode == kControlConfigGet)
+					SendConfigDump();
+			}
+			else if(name == "REF" && arguments.size() >= 2)
+			{
+				uint32_t value = static_cast<uint32_t>(strtoul(arguments[1].c_str(), nullptr, 10));
+				
+				// Bit 9 is take off, bit 8 toggles the emergency state
+				if(value & (1 << 9))
+					_state |= AR::ARDRONE_FLY_MASK;
+				else
+					_state &= ~AR::ARDRONE_FLY_MASK;
+				
+				if(value & (1 << 8))
+					_state |= AR::ARDRONE_EMERGENCY_MASK;
+				else
+					_state &= ~AR::ARDRONE_EMERGENCY_MASK;
+			}
+		}
+		
+		void ATThread(int socket)
+		{
+			char buffer[4096];
+			struct pollfd descriptor = { socket, POLLIN, 0 };
+			
+			std::string name;
+			std::vector<std::string> arguments;
+			
+			while(_running)
+			{
+				if(poll(&descriptor, 1, 100) <= 0)
+					continue;
+				
+				ssize_t length = recv(socket, buffer, sizeof(buffer), 0);
+				if(length <= 0)
+					continue;
+				
+				const char *temp = buffer;
+				const char *end  = buffer + length;
+				
+				while(temp < end)
+				{
+					const char *terminator = static_cast<const char *>(memchr(temp, '\r', end - temp));
+					if(!terminator)
+						terminator = end;
+					
+					if(ParseCommand(temp, terminator, name, arguments))
+						HandleCommand(name, arguments);
+					
+					temp = terminator + 1;
+				}
+			}
+		}
+		
+		
+		static size_t GetOptionSize(AR::NavdataTag tag)
+		{
+			switch(tag)
+			{
+#define OptionSize(name) case AR::NavdataTag::name: return sizeof(AR::NavdataOption##name);
+				OptionSize(Demo)
+				OptionSize(Time)
+				OptionSize(RawMeasures)
+				OptionSize(PhysMeasures)
+				OptionSize(GyrosOffsets)
+				OptionSize(EulerAngles)
+				OptionSize(References)
+				OptionSize(Trims)
+				OptionSize(RCReferences)
+				OptionSize(PWM)
+				OptionSize(Altitude)
+				OptionSize(VisionRaw)
+				OptionSize(Vision)
+				OptionSize(VisionPerf)
+				OptionSize(ADCDataFrame)
+				OptionSize(PressureRaw)
+				OptionSize(Magneto)
+				OptionSize(Wind)
+				OptionSize(KalmanPressure)
+				OptionSize(Wifi)
+				OptionSize(GPS)
+#undef OptionSize
+				default:
+					return 0;
+			}
+		}
+		
+		size_t BuildNavdata(uint8_t *buffer, uint32_t sequence)
+		{
+			uint32_t state = _state.load();
+			
+			NavdataHeader *header = reinterpret_cast<NavdataHeader *>(buffer);
+			header->header   = 0x55667788;
+			header->state    = state;
+			header->sequence = sequence;
+			header->vision   = 0;
+			
+			size_t length = sizeof(NavdataHeader);
+			
+			if(!(state & AR::ARDRONE_NAVDATA_BOOTSTRAP))
+			{
+				// Demo mode only ever sends the demo option, full mode sends everything that was asked for
+				uint32_t options = (state & AR::ARDRONE_NAVDATA_DEMO_MASK) ? (_options.load() | 1) : 0x0fffffff;
+				
+				for(uint16_t tag = 0; tag < 28; tag ++)
+				{
+					size_t size = GetOptionSize(static_cast<AR::NavdataTag>(tag));
+					
+					if(!(options & (1 << tag)) || size == 0)
+						continue;
+					
+					AR::NavdataOption *option = reinterpret_cast<AR::NavdataOption *>(buffer + length);
+					memset(option, 0, size);
+					
+					option->tag  = static_cast<AR::NavdataTag>(tag);
+					option->size = static_cast<uint16_t>(size);
+					
+					if(option->tag == AR::NavdataTag::Demo)
+					{
+						AR::NavdataOptionDemo *demo = static_cast<AR::NavdataOptionDemo *>(option);
+						bool flying = (state & AR::ARDRONE_FLY_MASK);
+						
+						demo->ctrl_state = (flying ? AR::ControlStateFlying : AR::ControlStateLanded) << 16;
+						demo->vbat_flying_percentage = 100 - ((sequence / 2000) % 100);
+						demo->psi = static_cast<float>(sequence % 360) * 1000.0f;
+						demo->altitude = flying ? 1000 : 0;
+					}
+					
+					if(option->tag == AR::NavdataTag::Time)
+						static_cast<AR::NavdataOptionTime *>(option)->time = sequence;
+					
+					length += size;
+				}
+			}
+			
+			uint32_t checksum = 0;
+			for(size_t i = 0; i < length; i ++)
+				checksum += buffer[i];
+			
+			AR::NavdataOptionChecksum *option = reinterpret_cast<AR::NavdataOptionChecksum *>(buffer + length);
+			option->tag  = AR::NavdataTag::Checksum;
+			option->size = sizeof(AR::NavdataOptionChecksum);
+			option->checksum = checksum;
+			
+			return length + sizeof(AR::NavdataOptionChecksum);
+		}
+		
+		void NavdataThread(int socket)
+		{
+			uint8_t buffer[4096];
+			
+			struct sockaddr_in client;
+			socklen_t clientLength = 0;
+			
+			struct pollfd descriptor = { socket, POLLIN, 0 };
+			
+			uint32_t sequence = 1;
+			
+			uint8_t held[4096];
+			size_t heldLength = 0;
+			
+			// Fixed seed, so runs with the same settings lose and reorder the same packets
+			std::minstd_rand random(1);
+			std::uniform_int_distribution<uint32_t> percent(0, 99);
+			
+			std::chrono::nanoseconds interval(_settings.navdataRate ? 1000000000 / _settings.navdataRate : 0);
+			std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+			
+			while(_running)
+			{
+				int timeout = 100;
+				
+				if(clientLength > 0)
+				{
+					auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+					timeout = std::max<int>(0, static_cast<int>(left.count()));
+				}
+				
+				// Any datagram from the client (re)starts the stream towards its address
+				if(poll(&descriptor, 1, timeout) > 0)
+				{
+					socklen_t length = sizeof(client);
+					ssize_t result = recvfrom(socket, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr *>(&client), &length);
+					
+					if(result >= 0)
+					{
+						if(clientLength == 0 && !_settings.quiet)
+							std::cout << "Navdata client " << inet_ntoa(client.sin_addr) << ":" << ntohs(client.sin_port) << std::endl;
+						
+						clientLength = length;
+						next = std::chrono::steady_clock::now();
+					}
+					
+					continue;
+				}
+				
+				if(clientLength == 0)
+					continue;
+				
+				// Millisecond poll granularity isn't good enough for 200 Hz, so finish off with a precise sleep
+				auto now = std::chrono::steady_clock::now();
+				if(now < next)
+				{
+					std::this_thread::sleep_until(next);
+					now = next;
+				}
+				
+				size_t length = BuildNavdata(buffer, sequence ++);
+				
+				if(percent(random) >= _settings.navdataLoss)
+				{
+					if(heldLength == 0 && percent(random) < _settings.navdataReorder)
+					{
+						memcpy(held, buffer, length);
+						heldLength = length;
+					}
+					else
+					{
+						if(sendto(socket, buffer, length, 0, reinterpret_cast<struct sockaddr *>(&client), clientLength) > 0)
+							_navdataPackets ++;
+						
+						if(heldLength > 0 && sendto(socket, held, heldLength, 0, reinterpret_cast<struct sockaddr *>(&client), clientLength) > 0)
+							_navdataPackets ++;
+						
+						heldLength = 0;
+					}
+				}
+				
+				next += interval;
+				
+				// Don't try to catch up on a backlog after a stall
+				if(next < now - std::chrono::milliseconds(100))
+					next = now;
+			}
+		}
+		
+		
+		// Splits a recording into its PaVE frames, or makes up frames of random data without one
+		std::vector<std::vector<uint8_t>> LoadVideo()
+		{
+			std::vector<std::vector<uint8_t>> frames;
+			
+			if(!_settings.videoFile.empty())
+			{
+				std::ifstream file(_settings.videoFile, std::ios::binary);
+				std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				
+				size_t offset = 0;
+				
+				while(offset + sizeof(AR::PAVE) <= data.size())
+				{
+					const AR::PAVE *pave = reinterpret_cast<const AR::PAVE *>(data.data() + offset);
+					size_t size = pave->header_size + pave->payload_size;
+					
+					if(memcmp(pave->signature, "PaVE", 4) != 0 || offset + size > data.size())
+						break;
+					
+					frames.emplace_back(data.begin() + offset, data.begin() + offset + size);
+					offset += size;
+				}
+				
+				if(frames.empty())
+					std::cerr << "No PaVE frames in " << _settings.videoFile << ", using synthetic frames" << std::endl;
+			}
+			
+			if(frames.empty())
+			{
+				for(uint32_t i = 0; i < 30; i ++)
+				{
+					std::vector<uint8_t> frame(sizeof(AR::PAVE) + _settings.frameSize);
+					AR::PAVE *pave = reinterpret_cast<AR::PAVE *>(frame.data());
+					
+					memcpy(pave->signature, "PaVE", 4);
+					pave->version = 2;
+					pave->video_codec = AR::PAVEVideoCodecMPEG4AVC;
+					pave->header_size = sizeof(AR::PAVE);
+					pave->payload_size = _settings.frameSize;
+					pave->encoded_stream_width = 640;
+					pave->encoded_stream_height = 368;
+					pave->display_width = 640;
+					pave->display_height = 360;
+					pave->total_chuncks = 1;
+					pave->frame_type = (i == 0) ? AR::PAVEFrameTypeIDRFrame : AR::PAVEFrameTypePFrame;
+					pave->control = AR::PAVEControlTypeData;
+					pave->total_slices = 1;
+					
+					// Keep the payload free of accidental PaVE signatures
+					for(size_t j = sizeof(AR::PAVE); j < frame.size(); j ++)
+						frame[j] = static_cast<uint8_t>((j * 7 + i) & 0x3f);
+					
+					frames.push_back(std::move(frame));
+				}
+			}
+			
+			return frames;
+		}
+		
+		void VideoThread(int socket)
+		{
+			std::vector<std::vector<uint8_t>> frames = LoadVideo();
+			std::chrono::nanoseconds interval(_settings.videoRate ? 1000000000 / _settings.videoRate : 0);
+			
+			while(_running)
+			{
+				int client = Accept(socket);
+				if(client == -1)
+					break;
+				
+				uint32_t number = 0;
+				auto next = std::chrono::steady_clock::now();
+				
+				while(_running)
+				{
+					std::vector<uint8_t> &frame = frames[number % frames.size()];
+					
+					AR::PAVE *pave = reinterpret_cast<AR::PAVE *>(frame.data());
+					pave->frame_number = number;
+					pave->timestamp = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+					
+					if(!WriteAll(client, frame.data(), frame.size()))
+						break;
+					
+					_videoBytes += frame.size();
+					number ++;
+					
+					if(interval.count() > 0)
+					{
+						next += interval;
+						std::this_thread::sleep_until(next);
+					}
+				}
+				
+				close(client);
+			}
+		}
+		
+		void ControlThread(int socket)
+		{
+			while(_running)
+			{
+				int client = Accept(socket);
+				if(client == -1)
+					break;
+				
+				{
+					std::lock_guard<std::mutex> lock(_lock);
+					
+					if(_control != -1)
+						close(_control);
+					
+					_control = client;
+				}
+			}
+			
+			std::lock_guard<std::mutex> lock(_lock);
+			
+			if(_control != -1)
+				close(_control);
+			
+			_control = -1;
+		}
+		
+		
+		Settings _settings;
+		
+		std::mutex _lock;
+		std::map<std::string, std::string> _config;
+		
+		std::atomic<uint32_t> _state;
+		std::atomic<uint32_t> _options;
+		int _control;
+		
+		std::atomic<uint64_t> _commands;
+		std::atomic<uint64_t> _navdataPackets;
+		std::atomic<uint64_t> _videoBytes;
+	};
+}
+
+int main(int argc, const char *argv[])
+{
+	Settings settings;
+	
+	for(int i = 1; i < argc; i ++)
+	{
+		std::string argument = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		
+		if(argument == "--quiet")
+		{
+			settings.quiet = true;
+			continue;
+		}
+		
+		if(!value)
+		{
+			std::cerr << "Missing value for " << argument << std::endl;
+			return EXIT_FAILURE;
+		}
+		
+		if(argument == "--address")
+			settings.address = value;
+		else if(argument == "--navdata-rate")
+			settings.navdataRate = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+		else if(argument == "--navdata-loss")
+			settings.navdataLoss = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+		else if(argument == "--navdata-reorder")
+			settings.navdataReorder = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+		else if(argument == "--video")
+			settings.videoFile = value;
+		else if(argument == "--video-fps")
+			settings.videoRate = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+		else if(argument == "--frame-size")
+			settings.frameSize = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+		else if(argument == "--config")
+			settings.configFile = value;
+		else
+		{
+			std::cerr << "Unknown argument " << argument << std::endl;
+			return EXIT_FAILURE;
+		}
+		
+		i ++;
+	}
+	
+	signal(SIGINT, &HandleSignal);
+	signal(SIGTERM, &HandleSignal);
+	
+	Simulator simulator(settings);
+	return simulator.Run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,237 @@
+//
+//  ARATCommands.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARATCommands__
+#define __libARDrone__ARATCommands__
+
+#include <string.h>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+namespace AR
+{
+	namespace AT
+	{
+		// Argument kinds of the AT grammar, each one writes itself including the leading comma
+		struct Int
+		{
+			typedef int32_t Type;
+			
+			static size_t GetMaxLength(Type) { return 12; }
+			static char *Write(char *buffer, Type value)
+			{
+				*buffer = ',';
+				return std::to_chars(buffer + 1, buffer + 12, value).ptr;
+			}
+		};
+		
+		struct UInt
+		{
+			typedef uint32_t Type;
+			
+			static size_t GetMaxLength(Type) { return 11; }
+			static char *Write(char *buffer, Type value)
+			{
+				*buffer = ',';
+				return std::to_chars(buffer + 1, buffer + 11, value).ptr;
+			}
+		};
+		
+		// Floats go over the wire as the decimal value of their bit pattern
+		struct Float
+		{
+			typedef float Type;
+			
+			static size_t GetMaxLength(Type) { return 12; }
+			static char *Write(char *buffer, Type value)
+			{
+				int32_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				
+				return Int::Write(buffer, bits);
+			}
+		};
+		
+		struct String
+		{
+			typedef std::string_view Type;
+			
+			static size_t GetMaxLength(Type value) { return value.length() + 3; }
+			static char *Write(char *buffer, Type value)
+			{
+				*buffer ++ = ',';
+				*buffer ++ = '"';
+				
+				memcpy(buffer, value.data(), value.length());
+				buffer += value.length();
+				
+				*buffer ++ = '"';
+				return buffer;
+			}
+		};
+		
+		// Queued commands with the same key replace each other, so only the newest one goes out with the next flush
+		enum class Coalescing : uint8_t
+		{
+			None,
+			Movement,
+			Reference
+		};
+		
+		static const size_t kCoalescingKeys = 3;
+		
+		// Known commands, used to break the AT statistics down
+		enum class Type : uint8_t
+		{
+			PCMD,
+			PCMD_MAG,
+			REF,
+			CONFIG,
+			CONFIG_ID,
+			CTRL,
+			FTRIM,
+			CALIB,
+			PMODE,
+			MISC,
+			Other
+		};
+		
+		static const size_t kTypes = 11;
+		
+		constexpr const char *kTypeNames[kTypes] = { "PCMD", "PCMD_MAG", "REF", "CONFIG", "CONFIG_ID", "CTRL", "FTRIM", "CALIB", "PMODE", "MISC", "Other" };
+		
+		constexpr Type GetType(std::string_view name)
+		{
+			for(size_t i = 0; i < kTypes - 1; i ++)
+			{
+				if(name == kTypeNames[i])
+					return static_cast<Type>(i);
+			}
+			
+			return Type::Other;
+		}
+		
+		constexpr const char *GetTypeName(Type type)
+		{
+			return kTypeNames[static_cast<size_t>(type)];
+		}
+		
+		// True if From converts to To without narrowing, so an uint32_t won't silently turn into a negative Int
+		template<class To, class From, class = void>
+		struct IsLossless : std::false_type
+		{};
+		
+		template<class To, class From>
+		struct IsLossless<To, From, std::void_t<decltype(To{ std::declval<From>() })>> : std::true_type
+		{};
+		
+		// A command with its "AT*NAME=" prefix formatted at compile time and a fixed argument list
+		template<class... Arguments>
+		class Descriptor
+		{
+		public:
+			// Room for any uint32_t sequence number
+			static constexpr size_t kSequenceLength = 10;
+			
+			template<size_t N>
+			constexpr Descriptor(const char (&name)[N], Coalescing coalescing = Coalescing::None) :
+				_prefix(),
+				_length(N + 3),
+				_coalescing(coalescing),
+				_type(AT::GetType(std::string_view(name, N - 1)))
+			{
+				static_assert(N + 3 <= sizeof(_prefix), "AT command name too long");
+				
+				_prefix[0] = 'A';
+				_prefix[1] = 'T';
+				_prefix[2] = '*';
+				
+				for(size_t i = 0; i < N - 1; i ++)
+					_prefix[3 + i] = name[i];
+				
+				_prefix[N + 2] = '=';
+			}
+			
+			constexpr const char *GetPrefix() const { return _prefix; }
+			constexpr size_t GetPrefixLength() const { return _length; }
+			constexpr Coalescing GetCoalescing() const { return _coalescing; }
+			constexpr Type GetType() const { return _type; }
+			
+			template<class... Values>
+			size_t GetMaxLength(const Values &...values) const
+			{
+				return _length + kSequenceLength + (static_cast<size_t>(0) + ... + Arguments::GetMaxLength(values)) + 1;
+			}
+			
+			// Writes the finished command into buffer, which has to hold GetMaxLength() bytes
+			template<class... Values>
+			size_t Encode(uint32_t sequence, char *buffer, const Values &...values) const
+			{
+				char *temp = buffer;
+				
+				memcpy(temp, _prefix, _length);
+				temp += _length;
+				
+				temp = std::to_chars(temp, temp + kSequenceLength, sequence).ptr;
+				temp = WriteArguments(temp, values...);
+				
+				return temp - buffer;
+			}
+			
+			// Like Encode(), but leaves out the sequence number, which belongs right after the prefix
+			template<class... Values>
+			size_t EncodeUnsequenced(char *buffer, const Values &...values) const
+			{
+				memcpy(buffer, _prefix, _length);
+				return WriteArguments(buffer + _length, values...) - buffer;
+			}
+			
+		private:
+			template<class... Values>
+			char *WriteArguments(char *buffer, const Values &...values) const
+			{
+				static_assert(sizeof...(Values) == sizeof...(Arguments), "Wrong number of arguments for this AT command");
+				static_assert((IsLossless<typename Arguments::Type, Values>::value && ...), "Argument doesn't match the type of the AT command");
+				
+				((buffer = Arguments::Write(buffer, typename Arguments::Type{ values })), ...);
+				
+				*buffer ++ = '\r';
+				return buffer;
+			}
+			
+			char _prefix[24];
+			size_t _length;
+			Coalescing _coalescing;
+			Type _type;
+		};
+		
+		inline constexpr Descriptor<Int, Float, Float, Float, Float> PCMD("PCMD", Coalescing::Movement);
+		inline constexpr Descriptor<Int, Float, Float, Float, Float, Float, Float> PCMD_MAG("PCMD_MAG", Coalescing::Movement);
+		inline constexpr Descriptor<UInt> REF("REF", Coalescing::Reference);
+		inline constexpr Descriptor<String, String> CONFIG("CONFIG");
+		inline constexpr Descriptor<String, String, String> CONFIG_ID("CONFIG_ID");
+		inline constexpr Descriptor<Int, Int> CTRL("CTRL");
+		inline constexpr Descriptor<> FTRIM("FTRIM");
+		inline constexpr Descriptor<Int> CALIB("CALIB");
+		inline constexpr Descriptor<Int> PMODE("PMODE");
+		inline constexpr Descriptor<Int, Int, Int, Int> MISC("MISC");
+	}
+}
+
+#endif /* defined(__libARDrone__ARATCommands__) */
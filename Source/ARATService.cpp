@@ -17,35 +17,153 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <unistd.h>
 #include "ARATService.h"
 
+#if __linux__
+#include <sys/timerfd.h>
+#define AR_HAS_TIMERFD 1
+#endif
+
 namespace AR
 {
+	ATCommand::ATCommand(const char *command)
+	{
+		Initialize(command, strlen(command));
+	}
+	
 	ATCommand::ATCommand(const std::string &command)
 	{
-		_stream << "AT*" << command << "=x";
+		Initialize(command.data(), command.length());
 	}
 	
-	std::string ATCommand::GetCommand(uint32_t sequence) const
+	void ATCommand::Initialize(const char *command, size_t length)
 	{
-		std::string string = _stream.str();
-		size_t pos = string.find("=x") + 1;
+		_overflow = (3 + length + 1 + kSequenceLength > kMaxLength);
+		
+		if(_overflow)
+			length = 0;
 		
-		std::stringstream temp;
-		temp << sequence;
+		_type = AT::GetType(std::string_view(command, length));
 		
-		string.replace(pos, 1, temp.str());
-		string.append("\r");
+		memcpy(_buffer, "AT*", 3);
+		memcpy(_buffer + 3, command, length);
+		_buffer[3 + length] = '=';
 		
-		return string;
+		_prefix = 3 + length + 1;
+		_length = _prefix + kSequenceLength;
 	}
 	
+	ATCommand &ATCommand::AppendString(const char *string, size_t length)
+	{
+		if(_overflow || _length + length + 3 > kMaxLength)
+		{
+			_overflow = true;
+			return *this;
+		}
+		
+		char *temp = _buffer + _length;
+		
+		*temp ++ = ',';
+		*temp ++ = '"';
+		
+		memcpy(temp, string, length);
+		temp += length;
+		
+		*temp ++ = '"';
+		
+		_length = temp - _buffer;
+		return *this;
+	}
 	
+	size_t ATCommand::Encode(uint32_t sequence, char *buffer) const
+	{
+		char *temp = buffer;
+		
+		memcpy(temp, _buffer, _prefix);
+		temp += _prefix;
+		
+		temp = std::to_chars(temp, temp + kSequenceLength, sequence).ptr;
+		
+		size_t arguments = _length - (_prefix + kSequenceLength);
+		
+		memcpy(temp, _buffer + _prefix + kSequenceLength, arguments);
+		temp += arguments;
+		
+		*temp ++ = '\r';
+		
+		return temp - buffer;
+	}
+	
+	size_t ATCommand::EncodeUnsequenced(char *buffer) const
+	{
+		size_t arguments = _length - (_prefix + kSequenceLength);
+		
+		memcpy(buffer, _buffer, _prefix);
+		memcpy(buffer + _prefix, _buffer + _prefix + kSequenceLength, arguments);
+		
+		buffer[_prefix + arguments] = '\r';
+		
+		return _prefix + arguments + 1;
+	}
+	
+	std::string ATCommand::GetCommand(uint32_t sequence) const
+	{
+		char buffer[kMaxLength + 1];
+		size_t length = Encode(sequence, buffer);
+		
+		return std::string(buffer, length);
+	}
+	
+	
+	
+	static Socket::Options ATSocketOptions()
+	{
+		// Control commands have to make it through even while the video stream saturates the link
+		Socket::Options options;
+		options.typeOfService = Socket::Options::kTOSExpedited;
+		
+		return options;
+	}
 	
 	ATService::ATService(Drone *drone, const std::string &address) :
 		Service(drone, "AT"),
-		_socket(new Socket(address, 5556))
-	{}
+		_socket(new Socket(address, 5556, Socket::Type::UDP, ATSocketOptions())),
+		_queue(1024),
+		_pending(false),
+		_flushNext(0),
+		_timer(-1),
+		_paced(false),
+		_pacingInterval(0),
+		_pacingWindow(0),
+		_requestedInterval(0),
+		_requestedWindow(0),
+		_gathering(false),
+		_coalesced(0),
+		_dropped(0),
+		_bytes(0),
+		_datagrams(0),
+		_splitDatagrams(0),
+		_queueHighWater(0),
+		_rateBytes(0),
+		_rateDatagrams(0),
+		_bytesPerSecond(0.0),
+		_datagramsPerSecond(0.0),
+		_rateEnd(0)
+	{
+		for(size_t i = 0; i < AT::kTypes; i ++)
+			_commands[i] = 0;
+		
+		for(size_t i = 0; i < AT::kCoalescingKeys; i ++)
+		{
+			_epochs[i] = 0;
+			_flushLatest[i] = std::string::npos;
+		}
+		
+		// Nothing to do unless commands were queued
+		SetTickInterval(std::chrono::milliseconds(0));
+	}
 	
 	ATService::~ATService()
 	{
@@ -54,57 +172,428 @@ namespace AR
 	
 	
 	
+	void ATService::SetPacing(std::chrono::microseconds interval, std::chrono::microseconds window)
+	{
+		std::lock_guard<std::mutex> lock(_pacingLock);
+		
+		_requestedInterval = interval;
+		_requestedWindow = std::min(window, interval);
+	}
+	
 	Service::State ATService::ConnectInternal()
 	{
 		_sequence = 1;
-		return _socket->Connect() ? State::Connected : State::Disconnected;
+		_lastFlush = Socket::Timestamp();
+		
+		{
+			// Tick() only ever looks at the latched copies, so SetPacing() can be called at any time
+			std::lock_guard<std::mutex> lock(_pacingLock);
+			
+			_pacingInterval = _requestedInterval;
+			_pacingWindow = _requestedWindow;
+		}
+		
+		if(!_socket->Connect())
+			return State::Disconnected;
+		
+#if AR_HAS_TIMERFD
+		if(_pacingInterval.count() > 0)
+		{
+			// The service thread blocks on the timer inside of Tick(), a reactor polls it instead
+			_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (IsEventDriven() ? TFD_NONBLOCK : 0));
+			
+			if(_timer != -1)
+			{
+				_deadline = std::chrono::steady_clock::now() + _pacingInterval;
+				_gathering = false;
+				
+				ArmTimer(_deadline);
+			}
+		}
+#endif
+		
+		_paced = (_timer != -1);
+		SetCanSleep(!_paced);
+		
+		return State::Connected;
 	}
 	
 	void ATService::DisconnectInternal()
 	{
 		_socket->Disconnect();
+		
+		if(_timer != -1)
+		{
+			close(_timer);
+			_timer = -1;
+		}
+		
+		_paced = false;
+	}
+	
+	
+	void ATService::ArmTimer(Socket::Timestamp deadline)
+	{
+#if AR_HAS_TIMERFD
+		// steady_clock is CLOCK_MONOTONIC, so the deadline can be handed to the kernel as is
+		std::chrono::nanoseconds time = deadline.time_since_epoch();
+		
+		struct itimerspec spec = {};
+		spec.it_value.tv_sec  = std::chrono::duration_cast<std::chrono::seconds>(time).count();
+		spec.it_value.tv_nsec = (time % std::chrono::seconds(1)).count();
+		
+		timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+#endif
+	}
+	
+	bool ATService::WaitForDeadline()
+	{
+		uint64_t expirations;
+		
+		// Fails with EAGAIN if a reactor ticked us for something else
+		if(read(_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+			return false;
+		
+		if(!_gathering && _pacingWindow.count() > 0 && _queue.IsEmpty())
+		{
+			_gathering = true;
+			ArmTimer(_deadline + _pacingWindow);
+			
+			return false;
+		}
+		
+		Socket::Timestamp now = std::chrono::steady_clock::now();
+		
+		_gathering = false;
+		_flushDeadline = _deadline;
+		
+		// Skip the deadlines we missed instead of sending a burst to catch up
+		do {
+			_deadline += _pacingInterval;
+		} while(_deadline <= now);
+		
+		ArmTimer(_deadline);
+		return true;
+	}
+	
+	void ATService::RecordFlush(Socket::Timestamp now)
+	{
+		if(_lastFlush != Socket::Timestamp())
+		{
+			std::chrono::nanoseconds interval = now - _lastFlush;
+			_sendInterval.Record(interval);
+			
+			if(_paced)
+			{
+				// Flushes that were skipped for lack of commands stretch the expected interval
+				std::chrono::nanoseconds expected = _flushDeadline - _lastFlushDeadline;
+				_sendJitter.Record(interval > expected ? interval - expected : expected - interval);
+			}
+		}
+		
+		_lastFlush = now;
+		_lastFlushDeadline = _flushDeadline;
 	}
 	
 	
 	void ATService::Send(const ATCommand &command)
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
+		char buffer[sizeof(Record) + ATCommand::kMaxLength + 1];
+		
+		if(!command.IsValid())
+			return;
+		
+		size_t length = command.EncodeUnsequenced(buffer + sizeof(Record));
+		Enqueue(buffer, length, command.GetPrefixLength(), AT::Coalescing::None, command.GetType());
+	}
 	
-		_queue.push_back(std::move(command.GetCommand(_sequence)));
-		_sequence ++;
+	void ATService::Enqueue(char *buffer, size_t length, size_t prefix, AT::Coalescing coalescing, AT::Type type)
+	{
+		Record record;
+		record.prefix = static_cast<uint16_t>(prefix);
+		record.coalescing = coalescing;
+		record.type = type;
+		record.epoch = _epochs[static_cast<size_t>(coalescing)].load(std::memory_order_acquire);
+		record.queued = std::chrono::steady_clock::now();
+		
+		memcpy(buffer, &record, sizeof(Record));
 		
-		Wakeup(WakeupReason::DataAvilable);
+		if(!_queue.Push(buffer, sizeof(Record) + length))
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		
+		// One wakeup per flush is enough, Tick() clears the flag before it drains the queue.
+		// Paced flushes wait for their timer instead
+		if(_paced.load(std::memory_order_relaxed))
+			return;
+		
+		// Both sides exchange the flag, so a producer that still sees it set is ordered before
+		// the clear in Tick() and its record is visible to the drain that follows
+		if(!_pending.exchange(true, std::memory_order_seq_cst))
+			Wakeup(WakeupReason::DataAvilable);
 	}
 	
-	void ATService::Tick(uint32_t reason)
+	void ATService::SendImmediate(const ATCommand &command)
+	{
+		Socket::Timestamp start = std::chrono::steady_clock::now();
+		char buffer[ATCommand::kMaxLength + 1];
+		
+		if(!command.IsValid())
+			return;
+		
+		size_t length = command.EncodeUnsequenced(buffer);
+		SendPriority(buffer, command.GetPrefixLength(), length, AT::Coalescing::None, command.GetType(), start);
+	}
+	
+	void ATService::SendPriority(const char *command, size_t prefix, size_t length, AT::Coalescing coalescing, AT::Type type, Socket::Timestamp start)
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
+		std::lock_guard<std::mutex> sendLock(_sendMutex);
+		
+		if(coalescing != AT::Coalescing::None)
+		{
+			size_t key = static_cast<size_t>(coalescing);
+			
+			if(_flushLatest[key] != std::string::npos && _flushLatest[key] >= _flushNext && !_flushEntries[_flushLatest[key]].superseded)
+			{
+				_flushEntries[_flushLatest[key]].superseded = true;
+				_coalesced.fetch_add(1, std::memory_order_relaxed);
+			}
+			
+			// Everything still in the queue is older than this command
+			_epochs[key].fetch_add(1, std::memory_order_acq_rel);
+		}
+		
+		char sequence[10];
+		char *end = std::to_chars(sequence, sequence + sizeof(sequence), _sequence ++).ptr;
+		
+		struct iovec vectors[3];
+		vectors[0].iov_base = const_cast<char *>(command);
+		vectors[0].iov_len  = prefix;
+		vectors[1].iov_base = sequence;
+		vectors[1].iov_len  = end - sequence;
+		vectors[2].iov_base = const_cast<char *>(command + prefix);
+		vectors[2].iov_len  = length - prefix;
+		
+		_socket->Send(vectors, 3);
+		
+		Socket::Timestamp now = std::chrono::steady_clock::now();
+		
+		_priorityLatency.Record(now - start);
+		_commands[static_cast<size_t>(type)].fetch_add(1, std::memory_order_relaxed);
+		
+		RecordDatagram(length + (end - sequence), now);
+	}
+	
+	void ATService::RecordDatagram(size_t length, Socket::Timestamp now)
+	{
+		_bytes.fetch_add(length, std::memory_order_relaxed);
+		_datagrams.fetch_add(1, std::memory_order_relaxed);
+		
+		if(_rateStart == Socket::Timestamp())
+			_rateStart = now;
+		
+		_rateBytes += length;
+		_rateDatagrams ++;
+		
+		std::chrono::duration<double> elapsed = now - _rateStart;
+		
+		if(elapsed.count() >= 1.0)
+		{
+			_bytesPerSecond.store(_rateBytes / elapsed.count(), std::memory_order_relaxed);
+			_datagramsPerSecond.store(_rateDatagrams / elapsed.count(), std::memory_order_relaxed);
+			_rateEnd.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+			
+			_rateStart = now;
+			_rateBytes = 0;
+			_rateDatagrams = 0;
+		}
+	}
+	
+	ATService::Statistics ATService::GetStatistics() const
+	{
+		Statistics statistics;
+		
+		for(size_t i = 0; i < AT::kTypes; i ++)
+			statistics.commands[i] = _commands[i].load(std::memory_order_relaxed);
+		
+		statistics.bytes = _bytes.load(std::memory_order_relaxed);
+		statistics.datagrams = _datagrams.load(std::memory_order_relaxed);
+		statistics.splitDatagrams = _splitDatagrams.load(std::memory_order_relaxed);
+		statistics.coalesced = _coalesced.load(std::memory_order_relaxed);
+		statistics.dropped = _dropped.load(std::memory_order_relaxed);
+		
+		// The rates are only refreshed when something is sent, so don't report a stale one
+		Socket::Timestamp end = Socket::Timestamp(Socket::Timestamp::duration(_rateEnd.load(std::memory_order_relaxed)));
+		bool current = (std::chrono::steady_clock::now() - end < std::chrono::seconds(2));
+		
+		statistics.bytesPerSecond = current ? _bytesPerSecond.load(std::memory_order_relaxed) : 0.0;
+		statistics.datagramsPerSecond = current ? _datagramsPerSecond.load(std::memory_order_relaxed) : 0.0;
+		
+		statistics.queueHighWater = _queueHighWater.load(std::memory_order_relaxed);
 		
+		statistics.queuedMean = _queueLatency.GetMean();
+		statistics.queuedMedian = _queueLatency.GetPercentile(50.0);
+		statistics.queued99 = _queueLatency.GetPercentile(99.0);
+		statistics.queued999 = _queueLatency.GetPercentile(99.9);
+		statistics.queuedMax = _queueLatency.GetMax();
+		
+		return statistics;
+	}
+	
+	bool ATService::FlushDatagram()
+	{
+		std::lock_guard<std::mutex> sendLock(_sendMutex);
+		
+		// Every command is gathered from its prefix, its sequence number and its arguments into datagrams of at most 1000 bytes
+		const size_t kMaxVectors = 192;
+		const size_t kSequenceLength = 10;
+		
+		struct iovec vectors[kMaxVectors];
+		char sequences[(kMaxVectors / 3) * kSequenceLength];
+		
+		size_t count = 0;
 		size_t length = 0;
-		std::stringstream stream;
+		size_t first = _flushNext;
+		char *sequence = sequences;
 		
-		for(const std::string &command : _queue)
+		for(; _flushNext < _flushEntries.size(); _flushNext ++)
 		{
-			if(length + command.length() > 1000)
+			const Entry &entry = _flushEntries[_flushNext];
+			
+			if(entry.superseded)
+				continue;
+			
+			char *end = std::to_chars(sequence, sequence + kSequenceLength, _sequence).ptr;
+			size_t size = entry.length + (end - sequence);
+			
+			if(count > 0 && (length + size > 1000 || count + 3 > kMaxVectors))
 			{
-				std::string string = stream.str().c_str();
-				_socket->Send(string.c_str(), string.length());
+				if(length + size > 1000)
+					_splitDatagrams.fetch_add(1, std::memory_order_relaxed);
+				
+				break;
+			}
+			
+			char *command = _flushQueue.data() + entry.offset;
+			
+			vectors[count].iov_base = command;
+			vectors[count].iov_len  = entry.prefix;
+			vectors[count + 1].iov_base = sequence;
+			vectors[count + 1].iov_len  = end - sequence;
+			vectors[count + 2].iov_base = command + entry.prefix;
+			vectors[count + 2].iov_len  = entry.length - entry.prefix;
+			
+			count += 3;
+			length += size;
+			sequence = end;
+			
+			_sequence ++;
+		}
+		
+		if(count > 0)
+		{
+			_socket->Send(vectors, count);
+			
+			Socket::Timestamp now = std::chrono::steady_clock::now();
+			uint64_t types[AT::kTypes] = {};
+			
+			for(size_t i = first; i < _flushNext; i ++)
+			{
+				const Entry &entry = _flushEntries[i];
+				
+				if(entry.superseded)
+					continue;
 				
-				length = 0;
-				stream.str("");
-				stream.clear();
+				types[static_cast<size_t>(entry.type)] ++;
+				_queueLatency.Record(now - entry.queued);
 			}
 			
-			stream << command;
-			length += command.length();
+			for(size_t i = 0; i < AT::kTypes; i ++)
+			{
+				if(types[i])
+					_commands[i].fetch_add(types[i], std::memory_order_relaxed);
+			}
+			
+			RecordDatagram(length, now);
 		}
 		
-		if(length > 0)
+		return (_flushNext < _flushEntries.size());
+	}
+	
+	void ATService::Tick(uint32_t reason)
+	{
+		if(_paced && !WaitForDeadline())
+			return;
+		
+		_pending.exchange(false, std::memory_order_seq_cst);
+		
+		size_t queued = 0;
+		size_t waiting = 0;
+		
 		{
-			std::string string = stream.str().c_str();
-			_socket->Send(string.c_str(), string.length());
+			std::lock_guard<std::mutex> sendLock(_sendMutex);
+			
+			_flushQueue.clear();
+			_flushEntries.clear();
+			_flushNext = 0;
+			
+			for(size_t i = 0; i < AT::kCoalescingKeys; i ++)
+				_flushLatest[i] = std::string::npos;
+			
+			// Drain the queue at once, senders can keep queueing while the batch goes out
+			size_t offset = 0;
+			
+			while(_queue.Pop(_flushQueue))
+			{
+				waiting ++;
+				
+				Record record;
+				memcpy(&record, _flushQueue.data() + offset, sizeof(Record));
+				
+				Entry entry = { offset + sizeof(Record), record.prefix, _flushQueue.size() - offset - sizeof(Record), false, record.type, record.queued };
+				offset = _flushQueue.size();
+				
+				if(record.coalescing != AT::Coalescing::None)
+				{
+					size_t key = static_cast<size_t>(record.coalescing);
+					size_t &latest = _flushLatest[key];
+					
+					if(record.epoch != _epochs[key].load(std::memory_order_acquire))
+					{
+						// A priority command went out after this one was queued
+						_coalesced.fetch_add(1, std::memory_order_relaxed);
+						continue;
+					}
+					
+					if(latest != std::string::npos)
+					{
+						_flushEntries[latest].superseded = true;
+						_coalesced.fetch_add(1, std::memory_order_relaxed);
+						
+						queued --;
+					}
+					
+					latest = _flushEntries.size();
+				}
+				
+				_flushEntries.push_back(entry);
+				queued ++;
+			}
 		}
 		
-		_queue.clear();
+		// The queue only shrinks here, so its depth peaks right before it is drained
+		if(waiting > _queueHighWater.load(std::memory_order_relaxed))
+			_queueHighWater.store(waiting, std::memory_order_relaxed);
+		
+		if(queued == 0)
+			return;
+		
+		RecordFlush(std::chrono::steady_clock::now());
+		
+		// The send lock is dropped between datagrams, so priority commands don't wait for a whole burst
+		while(FlushDatagram())
+		{}
 	}
 }
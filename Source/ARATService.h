@@ -20,33 +20,55 @@
 #define __libARDrone__ARATService__
 
 #include <mutex>
+#include <atomic>
 #include <string>
-#include <sstream>
 #include <vector>
+#include <charconv>
+#include <string.h>
 
 #include "ARService.h"
 #include "ARSocket.h"
+#include "ARATCommands.h"
+#include "ARHistogram.h"
+#include "ARRingBuffer.h"
 
 namespace AR
 {
 	class ATCommand
 	{
 	public:
+		// The drone drops commands longer than that
+		static const size_t kMaxLength = 1024;
+		
+		ATCommand(const char *command);
 		ATCommand(const std::string &command);
 		
 		std::string GetCommand(uint32_t sequence) const;
 		
-		ATCommand &operator << (const std::string &val) { _stream << ",\"" << val <<  "\""; return *this; }
-		ATCommand &operator << (const char *val) { _stream << ",\"" << val <<  "\""; return *this; }
-		ATCommand &operator << (bool val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (short val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (unsigned short val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (int val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (unsigned int val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (long val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (unsigned long val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (long long val) { _stream << "," << val; return *this; }
-		ATCommand &operator << (unsigned long long val) { _stream << "," << val; return *this; }
+		// Writes the finished command into buffer, which has to hold at least GetMaxEncodedLength() bytes.
+		// Returns the number of bytes written
+		size_t Encode(uint32_t sequence, char *buffer) const;
+		size_t GetMaxEncodedLength() const { return _length + 1; }
+		
+		// Like Encode(), but leaves out the sequence number, which belongs right after the prefix
+		size_t EncodeUnsequenced(char *buffer) const;
+		size_t GetPrefixLength() const { return _prefix; }
+		AT::Type GetType() const { return _type; }
+		
+		// False if the arguments didn't fit into kMaxLength, the command is then dropped by the ATService
+		bool IsValid() const { return !_overflow; }
+		
+		ATCommand &operator << (const std::string &val) { return AppendString(val.data(), val.length()); }
+		ATCommand &operator << (const char *val) { return AppendString(val, strlen(val)); }
+		ATCommand &operator << (bool val) { return AppendInteger(val ? 1 : 0); }
+		ATCommand &operator << (short val) { return AppendInteger(val); }
+		ATCommand &operator << (unsigned short val) { return AppendInteger(val); }
+		ATCommand &operator << (int val) { return AppendInteger(val); }
+		ATCommand &operator << (unsigned int val) { return AppendInteger(val); }
+		ATCommand &operator << (long val) { return AppendInteger(val); }
+		ATCommand &operator << (unsigned long val) { return AppendInteger(val); }
+		ATCommand &operator << (long long val) { return AppendInteger(val); }
+		ATCommand &operator << (unsigned long long val) { return AppendInteger(val); }
 		ATCommand &operator << (float val)
 		{
 			union
@@ -57,32 +79,230 @@ namespace AR
 			
 			t.f = val;
 			
-			_stream << "," << t.i;
-			return *this;
+			return AppendInteger(t.i);
 		}
 		
 	private:
-		std::stringstream _stream;
+		// Room for any uint32_t between the "=" and the arguments, filled in by Encode()
+		static const size_t kSequenceLength = 10;
+		
+		void Initialize(const char *command, size_t length);
+		ATCommand &AppendString(const char *string, size_t length);
+		
+		template<class T>
+		ATCommand &AppendInteger(T value)
+		{
+			char *begin = _buffer + _length;
+			char *end   = _buffer + kMaxLength;
+			
+			if(_overflow || begin == end)
+			{
+				_overflow = true;
+				return *this;
+			}
+			
+			*begin = ',';
+			std::to_chars_result result = std::to_chars(begin + 1, end, value);
+			
+			if(result.ec != std::errc())
+			{
+				_overflow = true;
+				return *this;
+			}
+			
+			_length = result.ptr - _buffer;
+			return *this;
+		}
+		
+		char _buffer[kMaxLength];
+		size_t _prefix;
+		size_t _length;
+		bool _overflow;
+		AT::Type _type;
 	};
 	
 	class ATService : public Service
 	{
 	public:
+		friend class Benchmark;
+		
+		struct Statistics
+		{
+			uint64_t commands[AT::kTypes]; // Commands that went out, indexed by AT::Type
+			uint64_t bytes;
+			uint64_t datagrams;
+			uint64_t splitDatagrams; // Datagrams that had to be started because the previous one hit 1000 bytes
+			uint64_t coalesced;
+			uint64_t dropped;
+			
+			// Over the last second that had traffic, zero once the link has been quiet for longer than that
+			double bytesPerSecond;
+			double datagramsPerSecond;
+			
+			// Most commands that were waiting for a single flush
+			size_t queueHighWater;
+			
+			// Time from Send() until the command was handed to the socket
+			std::chrono::nanoseconds queuedMean;
+			std::chrono::nanoseconds queuedMedian;
+			std::chrono::nanoseconds queued99;
+			std::chrono::nanoseconds queued999;
+			std::chrono::nanoseconds queuedMax;
+		};
+		
 		ATService(Drone *drone, const std::string &address);
 		~ATService() override;
 		
 		void Send(const ATCommand &command);
 		
+		template<class... Arguments, class... Values>
+		void Send(const AT::Descriptor<Arguments...> &descriptor, const Values &...values)
+		{
+			char buffer[sizeof(Record) + ATCommand::kMaxLength + 1];
+			
+			if(descriptor.GetMaxLength(values...) > ATCommand::kMaxLength + 1)
+				return;
+			
+			size_t length = descriptor.EncodeUnsequenced(buffer + sizeof(Record), values...);
+			Enqueue(buffer, length, descriptor.GetPrefixLength(), descriptor.GetCoalescing(), descriptor.GetType());
+		}
+		
+		// Sends the command on the calling thread, ahead of everything that is still queued.
+		// Queued commands it would coalesce with are dropped, so a stale REF can't override it
+		void SendImmediate(const ATCommand &command);
+		
+		template<class... Arguments, class... Values>
+		void SendImmediate(const AT::Descriptor<Arguments...> &descriptor, const Values &...values)
+		{
+			Socket::Timestamp start = std::chrono::steady_clock::now();
+			char buffer[ATCommand::kMaxLength + 1];
+			
+			if(descriptor.GetMaxLength(values...) > sizeof(buffer))
+				return;
+			
+			size_t length = descriptor.EncodeUnsequenced(buffer, values...);
+			SendPriority(buffer, descriptor.GetPrefixLength(), length, descriptor.GetCoalescing(), descriptor.GetType(), start);
+		}
+		
+		// Flushes the queue on a timer every interval instead of as soon as commands are queued, so the
+		// drone sees a steady cadence. If the queue is empty when the timer fires, the flush is held back
+		// for up to window to gather late commands. Zero disables pacing, takes effect on the next connect
+		void SetPacing(std::chrono::microseconds interval, std::chrono::microseconds window = std::chrono::microseconds(0));
+		bool IsPaced() const { return _paced.load(std::memory_order_relaxed); }
+		
+		// Time between two flushes that sent something
+		const Histogram &GetSendInterval() const { return _sendInterval; }
+		// Deviation of the time between two paced flushes from their timer deadlines
+		const Histogram &GetSendJitter() const { return _sendJitter; }
+		
+		// Assembled from relaxed atomics, so the fields are individually but not mutually consistent
+		Statistics GetStatistics() const;
+		const Histogram &GetQueueLatency() const { return _queueLatency; }
+		
+		// Number of queued commands that were replaced by a newer one before they went out
+		uint64_t GetCoalescedCommands() const { return _coalesced.load(std::memory_order_relaxed); }
+		// Number of commands that found the queue full, which only happens while the service isn't flushing
+		uint64_t GetDroppedCommands() const { return _dropped.load(std::memory_order_relaxed); }
+		// Time from the SendImmediate() call until the datagram was handed to the socket
+		const Histogram &GetPriorityLatency() const { return _priorityLatency; }
+		
 	protected:
 		void Tick(uint32_t reason) final;
 		
 		State ConnectInternal() final;
 		void DisconnectInternal() final;
 		
+		Socket *GetSocket() const final { return _socket; }
+		int GetDescriptor() const final { return _timer; }
+		
+		// Header of every record in the queue, followed by the command without its sequence number
+		struct Record
+		{
+			uint16_t prefix;
+			AT::Coalescing coalescing;
+			AT::Type type;
+			uint32_t epoch;
+			Socket::Timestamp queued;
+		};
+		
+		// buffer starts with room for the Record, followed by length bytes of the command
+		void Enqueue(char *buffer, size_t length, size_t prefix, AT::Coalescing coalescing, AT::Type type);
+		void SendPriority(const char *command, size_t prefix, size_t length, AT::Coalescing coalescing, AT::Type type, Socket::Timestamp start);
+		bool FlushDatagram();
+		
+		// Consumes a timer expiration and returns true if the queue should be flushed now
+		bool WaitForDeadline();
+		void ArmTimer(Socket::Timestamp deadline);
+		void RecordFlush(Socket::Timestamp now);
+		// Expects _sendMutex to be held
+		void RecordDatagram(size_t length, Socket::Timestamp now);
+		
+		struct Entry
+		{
+			size_t offset;
+			size_t prefix;
+			size_t length;
+			bool superseded;
+			AT::Type type;
+			Socket::Timestamp queued;
+		};
+		
 		Socket *_socket;
-		std::mutex _mutex;
+		
+		// Senders only touch the lock-free queue. _sendMutex guards the sequence number, the socket and
+		// the batch that is being flushed, and is only held for one datagram at a time
+		RingBuffer _queue;
+		std::atomic<bool> _pending;
+		
+		std::mutex _sendMutex;
 		uint32_t _sequence;
-		std::vector<std::string> _queue;
+		
+		// Bumped by priority commands, queued commands of an older epoch with the same key are dropped
+		std::atomic<uint32_t> _epochs[AT::kCoalescingKeys];
+		
+		// Commands are queued without their sequence number, it is assigned when the queue is flushed
+		// so that coalesced commands don't leave gaps. The buffers keep their capacity between ticks
+		std::vector<char> _flushQueue;
+		std::vector<Entry> _flushEntries;
+		size_t _flushLatest[AT::kCoalescingKeys];
+		size_t _flushNext;
+		
+		// Paced flushes are driven by a timerfd with absolute deadlines, so late ticks don't drift the phase
+		int _timer;
+		std::atomic<bool> _paced;
+		std::chrono::microseconds _pacingInterval;
+		std::chrono::microseconds _pacingWindow;
+		
+		// What SetPacing() asked for, latched into the two above by ConnectInternal()
+		std::mutex _pacingLock;
+		std::chrono::microseconds _requestedInterval;
+		std::chrono::microseconds _requestedWindow;
+		Socket::Timestamp _deadline;
+		Socket::Timestamp _flushDeadline;
+		Socket::Timestamp _lastFlush;
+		Socket::Timestamp _lastFlushDeadline;
+		bool _gathering;
+		
+		std::atomic<uint64_t> _coalesced;
+		std::atomic<uint64_t> _dropped;
+		Histogram _priorityLatency;
+		Histogram _sendInterval;
+		Histogram _sendJitter;
+		
+		// Written by whoever holds _sendMutex, read without locks by GetStatistics()
+		std::atomic<uint64_t> _commands[AT::kTypes];
+		std::atomic<uint64_t> _bytes;
+		std::atomic<uint64_t> _datagrams;
+		std::atomic<uint64_t> _splitDatagrams;
+		std::atomic<size_t> _queueHighWater;
+		Histogram _queueLatency;
+		
+		Socket::Timestamp _rateStart;
+		uint64_t _rateBytes;
+		uint64_t _rateDatagrams;
+		std::atomic<double> _bytesPerSecond;
+		std::atomic<double> _datagramsPerSecond;
+		std::atomic<Socket::Timestamp::rep> _rateEnd;
 	};
 }
 
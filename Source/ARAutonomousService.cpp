@@ -24,8 +24,7 @@ namespace AR
 	AutonomousService::AutonomousService(Drone *drone) :
 		Service(drone, "Autonomous"),
 		_wantsRunning(false),
-		_state(AutonomyState::Stopped),
-		_navdata(nullptr)
+		_state(AutonomyState::Stopped)
 	{
 		GetDrone()->AddNavdataSubscriber(std::bind(&AutonomousService::ConsumeNavdata, this, std::placeholders::_1), this);
 	}
@@ -33,7 +32,6 @@ namespace AR
 	AutonomousService::~AutonomousService()
 	{
 		GetDrone()->RemoveNavdataSubscriber(this);
-		delete _navdata;
 	}
 	
 	
@@ -67,8 +65,7 @@ namespace AR
 	{
 		std::lock_guard<std::mutex> lock(_mutex);
 		
-		delete _navdata;
-		_navdata = navdata->CopyWithTags(NavdataOptions(NavdataTag::Demo, NavdataTag::GPS, NavdataTag::Magneto));
+		_navdata = NavdataRef(navdata);
 		
 		_freshNavdata = true;
 	}
@@ -102,7 +99,7 @@ namespace AR
 		NavdataOptionMagneto *magneto = _navdata->GetOptionWithTag<NavdataOptionMagneto>(NavdataTag::Magneto);
 		NavdataOptionGPS *gps = _navdata->GetOptionWithTag<NavdataOptionGPS>(NavdataTag::GPS);
 		
-		if(!demo)
+		if(!_navdata->HasOptions(NavdataOptions(NavdataTag::Demo, NavdataTag::GPS, NavdataTag::Magneto)))
 			return false;
 		
 		
@@ -214,12 +211,12 @@ namespace AR
 		if(time <= _cooldown)
 			return;
 		
+		if(!_navdata->HasOptions(NavdataOptions(NavdataTag::GPS, NavdataTag::Magneto)))
+			return;
+		
 		NavdataOptionMagneto *magneto = _navdata->GetOptionWithTag<NavdataOptionMagneto>(NavdataTag::Magneto);
 		NavdataOptionGPS *gps = _navdata->GetOptionWithTag<NavdataOptionGPS>(NavdataTag::GPS);
 		
-		if(!gps || !magneto)
-			return;
-		
 		switch(_state.load())
 		{
 			case AutonomyState::Stopped:
@@ -120,7 +120,7 @@ namespace AR
 		bool _isTrimmed;
 		bool _needsCalibration;
 		
-		Navdata *_navdata;
+		NavdataRef _navdata;
 		bool _freshNavdata;
 		
 		std::list<Command> _commands;
@@ -0,0 +1,306 @@
+//
+//  ARCapture.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <string.h>
+#include <thread>
+#include <algorithm>
+#include "ARCapture.h"
+
+namespace AR
+{
+	static const char kCaptureMagic[4] = { 'A', 'R', 'C', 'P' };
+	static const uint32_t kCaptureVersion = 1;
+	
+	struct __CaptureRecord
+	{
+		uint64_t time;
+		uint16_t port;
+		uint8_t direction;
+		uint8_t reserved;
+		uint32_t length;
+	} __attribute__((packed));
+	
+	
+	Capture::Capture() :
+		_open(false),
+		_file(nullptr)
+	{}
+	
+	Capture::~Capture()
+	{
+		Close();
+	}
+	
+	bool Capture::Open(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		if(_file)
+		{
+			fclose(_file);
+			_file = nullptr;
+		}
+		
+		if(!(_file = fopen(path.c_str(), "wb")))
+		{
+			_open = false;
+			return false;
+		}
+		
+		// Keep the writes in the receive paths away from the disk
+		_fileBuffer.resize(1024 * 1024);
+		setvbuf(_file, _fileBuffer.data(), _IOFBF, _fileBuffer.size());
+		
+		fwrite(kCaptureMagic, sizeof(kCaptureMagic), 1, _file);
+		fwrite(&kCaptureVersion, sizeof(kCaptureVersion), 1, _file);
+		
+		_start = std::chrono::steady_clock::now();
+		_open  = true;
+		
+		return true;
+	}
+	
+	void Capture::Close()
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		if(_file)
+		{
+			fclose(_file);
+			_file = nullptr;
+		}
+		
+		_open = false;
+	}
+	
+	bool Capture::WriteHeader(uint16_t port, Direction direction, size_t length, Socket::Timestamp timestamp)
+	{
+		if(!_file)
+			return false;
+		
+		__CaptureRecord record;
+		record.time = (timestamp > _start) ? std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - _start).count() : 0;
+		record.port = port;
+		record.direction = static_cast<uint8_t>(direction);
+		record.reserved  = 0;
+		record.length    = static_cast<uint32_t>(length);
+		
+		fwrite(&record, sizeof(record), 1, _file);
+		return true;
+	}
+	
+	void Capture::Record(uint16_t port, Direction direction, const void *data, size_t length, Socket::Timestamp timestamp)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		if(WriteHeader(port, direction, length, timestamp))
+			fwrite(data, length, 1, _file);
+	}
+	
+	void Capture::Record(uint16_t port, Direction direction, const struct iovec *vectors, size_t count, Socket::Timestamp timestamp)
+	{
+		size_t length = 0;
+		
+		for(size_t i = 0; i < count; i ++)
+			length += vectors[i].iov_len;
+		
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		if(WriteHeader(port, direction, length, timestamp))
+		{
+			for(size_t i = 0; i < count; i ++)
+				fwrite(vectors[i].iov_base, vectors[i].iov_len, 1, _file);
+		}
+	}
+	
+	
+	
+	Replay::Replay() :
+		_realtime(true),
+		_started(false)
+	{}
+	
+	bool Replay::Open(const std::string &path, bool realtime)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		_data.clear();
+		_streams.clear();
+		_realtime = realtime;
+		_started  = false;
+		
+		FILE *file = fopen(path.c_str(), "rb");
+		if(!file)
+			return false;
+		
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		
+		_data.resize(size > 0 ? size : 0);
+		size_t read = fread(_data.data(), 1, _data.size(), file);
+		fclose(file);
+		
+		if(read != _data.size() || _data.size() < 8 || memcmp(_data.data(), kCaptureMagic, sizeof(kCaptureMagic)) != 0)
+		{
+			_data.clear();
+			return false;
+		}
+		
+		uint32_t version;
+		memcpy(&version, _data.data() + 4, sizeof(version));
+		
+		if(version != kCaptureVersion)
+		{
+			_data.clear();
+			return false;
+		}
+		
+		// Index the received payloads per port, a truncated record at the end is simply dropped
+		size_t offset = 8;
+		
+		while(offset + sizeof(__CaptureRecord) <= _data.size())
+		{
+			__CaptureRecord record;
+			memcpy(&record, _data.data() + offset, sizeof(record));
+			
+			offset += sizeof(record);
+			
+			if(offset + record.length > _data.size())
+				break;
+			
+			if(record.direction == static_cast<uint8_t>(Capture::Direction::Received))
+			{
+				Stream &stream = _streams[record.port];
+				stream.records.push_back({ record.time, offset, record.length });
+			}
+			
+			offset += record.length;
+		}
+		
+		for(auto &pair : _streams)
+		{
+			pair.second.next = 0;
+			pair.second.consumed = 0;
+		}
+		
+		return true;
+	}
+	
+	void Replay::Rewind()
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		for(auto &pair : _streams)
+		{
+			pair.second.next = 0;
+			pair.second.consumed = 0;
+		}
+		
+		_started = false;
+	}
+	
+	bool Replay::IsFinished()
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		for(auto &pair : _streams)
+		{
+			if(pair.second.next < pair.second.records.size())
+				return false;
+		}
+		
+		return true;
+	}
+	
+	Socket::Result Replay::Read(uint16_t port, bool stream, void *data, size_t maximum, size_t *actual, bool wait, std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		
+		auto now = std::chrono::steady_clock::now();
+		auto deadline = now + ((timeout.count() > 0) ? timeout : std::chrono::milliseconds(2000));
+		
+		// All ports share one clock, so they stay interleaved the way they were recorded
+		if(!_started)
+		{
+			_start = now;
+			_started = true;
+		}
+		
+		auto iterator = _streams.find(port);
+		
+		while(1)
+		{
+			if(iterator == _streams.end() || iterator->second.next >= iterator->second.records.size())
+			{
+				if(!wait)
+					return Socket::Result::WouldBlock;
+				
+				// Behave like an idle socket once the recording ran out
+				lock.unlock();
+				std::this_thread::sleep_until(deadline);
+				
+				return Socket::Result::Timeout;
+			}
+			
+			Stream &source = iterator->second;
+			const Record &record = source.records[source.next];
+			
+			if(_realtime)
+			{
+				Socket::Timestamp due = _start + std::chrono::duration_cast<Socket::Timestamp::duration>(std::chrono::nanoseconds(record.time));
+				
+				if(due > std::chrono::steady_clock::now())
+				{
+					if(!wait)
+						return Socket::Result::WouldBlock;
+					
+					lock.unlock();
+					std::this_thread::sleep_until(std::min(due, deadline));
+					lock.lock();
+					
+					if(due > deadline)
+						return Socket::Result::Timeout;
+					
+					continue;
+				}
+			}
+			
+			const uint8_t *payload = _data.data() + record.offset + source.consumed;
+			size_t available = record.length - source.consumed;
+			size_t length = std::min(available, maximum);
+			
+			memcpy(data, payload, length);
+			
+			if(stream && length < available)
+			{
+				source.consumed += length;
+			}
+			else
+			{
+				source.consumed = 0;
+				source.next ++;
+			}
+			
+			if(actual)
+				*actual = length;
+			
+			return Socket::Result::Success;
+		}
+	}
+}
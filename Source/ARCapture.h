@@ -0,0 +1,112 @@
+//
+//  ARCapture.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARCapture__
+#define __libARDrone__ARCapture__
+
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ARSocket.h"
+
+namespace AR
+{
+	// Records every payload that goes through the sockets of a drone. The file starts with the
+	// magic "ARCP" and a uint32_t version, followed by records of
+	//   uint64_t time (nanoseconds on the steady clock since the capture was opened)
+	//   uint16_t port, uint8_t direction, uint8_t reserved, uint32_t length, payload
+	class Capture
+	{
+	public:
+		enum class Direction : uint8_t
+		{
+			Received,
+			Sent
+		};
+		
+		Capture();
+		~Capture();
+		
+		bool Open(const std::string &path);
+		void Close();
+		
+		bool IsOpen() const { return _open.load(std::memory_order_relaxed); }
+		
+		void Record(uint16_t port, Direction direction, const void *data, size_t length, Socket::Timestamp timestamp);
+		void Record(uint16_t port, Direction direction, const struct iovec *vectors, size_t count, Socket::Timestamp timestamp);
+		
+	private:
+		bool WriteHeader(uint16_t port, Direction direction, size_t length, Socket::Timestamp timestamp);
+		
+		std::mutex _lock;
+		std::atomic<bool> _open;
+		
+		FILE *_file;
+		std::vector<char> _fileBuffer;
+		Socket::Timestamp _start;
+	};
+	
+	// Feeds the received payloads of a capture back into sockets, either with the recorded
+	// timing or as fast as the services can take them. Everything sent is dropped.
+	// Without realtime, every port runs ahead on its own, so the config handshake usually
+	// sees stale navdata and Drone::Connect() fails, while the services still get all data.
+	// To time parsing on real traffic, ARDroneBench reads the navdata of a capture directly.
+	class Replay
+	{
+	public:
+		Replay();
+		
+		bool Open(const std::string &path, bool realtime = true);
+		void Rewind();
+		
+		bool IsRealtime() const { return _realtime; }
+		// True once every received payload was handed out
+		bool IsFinished();
+		
+		// Streams can be read in pieces, datagrams are handed out whole and truncated to maximum
+		Socket::Result Read(uint16_t port, bool stream, void *data, size_t maximum, size_t *actual, bool wait, std::chrono::milliseconds timeout);
+		
+	private:
+		struct Record
+		{
+			uint64_t time;
+			size_t offset;
+			uint32_t length;
+		};
+		
+		struct Stream
+		{
+			std::vector<Record> records;
+			size_t next;
+			size_t consumed;
+		};
+		
+		std::mutex _lock;
+		std::vector<uint8_t> _data;
+		std::unordered_map<uint16_t, Stream> _streams;
+		
+		bool _realtime;
+		bool _started;
+		Socket::Timestamp _start;
+	};
+}
+
+#endif /* defined(__libARDrone__ARCapture__) */
@@ -0,0 +1,186 @@
+//
+//  ARChecksum.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "ARChecksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define AR_HAS_X86_KERNELS 1
+	#include <immintrin.h>
+#endif
+
+namespace AR
+{
+	namespace Checksum
+	{
+		typedef uint32_t (*SumFunction)(const uint8_t *data, size_t length);
+		
+		static uint32_t SumScalar(const uint8_t *data, size_t length)
+		{
+			uint32_t sum = 0;
+			
+			for(size_t i = 0; i < length; i ++)
+				sum += data[i];
+			
+			return sum;
+		}
+		
+#if AR_HAS_X86_KERNELS
+		// psadbw against zero adds up eight bytes into each 64 bit lane, the lanes can't overflow for anything we'd ever sum
+		__attribute__((target("sse2")))
+		static uint32_t SumSSE2(const uint8_t *data, size_t length)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i sum0 = zero;
+			__m128i sum1 = zero;
+			
+			for(; length >= 64; data += 64, length -= 64)
+			{
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32));
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48));
+				
+				sum0 = _mm_add_epi64(sum0, _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+				sum1 = _mm_add_epi64(sum1, _mm_add_epi64(_mm_sad_epu8(c, zero), _mm_sad_epu8(d, zero)));
+			}
+			
+			for(; length >= 16; data += 16, length -= 16)
+			{
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+				sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(a, zero));
+			}
+			
+			sum0 = _mm_add_epi64(sum0, sum1);
+			sum0 = _mm_add_epi64(sum0, _mm_unpackhi_epi64(sum0, sum0));
+			
+			return static_cast<uint32_t>(_mm_cvtsi128_si32(sum0)) + SumScalar(data, length);
+		}
+		
+		__attribute__((target("avx2")))
+		static uint32_t SumAVX2(const uint8_t *data, size_t length)
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			__m256i sum0 = zero;
+			__m256i sum1 = zero;
+			
+			for(; length >= 128; data += 128, length -= 128)
+			{
+				__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+				__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 64));
+				__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 96));
+				
+				sum0 = _mm256_add_epi64(sum0, _mm256_add_epi64(_mm256_sad_epu8(a, zero), _mm256_sad_epu8(b, zero)));
+				sum1 = _mm256_add_epi64(sum1, _mm256_add_epi64(_mm256_sad_epu8(c, zero), _mm256_sad_epu8(d, zero)));
+			}
+			
+			for(; length >= 32; data += 32, length -= 32)
+			{
+				__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+				sum0 = _mm256_add_epi64(sum0, _mm256_sad_epu8(a, zero));
+			}
+			
+			sum0 = _mm256_add_epi64(sum0, sum1);
+			
+			__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sum0), _mm256_extracti128_si256(sum0, 1));
+			
+			if(length >= 16)
+			{
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+				sum = _mm_add_epi64(sum, _mm_sad_epu8(a, _mm_setzero_si128()));
+				
+				data += 16;
+				length -= 16;
+			}
+			
+			sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+			uint32_t result = static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+			
+			// Dirty upper halves make every legacy SSE instruction afterwards pay for a state transition,
+			// the compiler doesn't clear them on its own since the function is only AVX2 by attribute
+			_mm256_zeroupper();
+			
+			return result + SumScalar(data, length);
+		}
+#endif
+		
+		static SumFunction GetFunction(Kernel kernel)
+		{
+			switch(kernel)
+			{
+#if AR_HAS_X86_KERNELS
+				case Kernel::SSE2:
+					return &SumSSE2;
+				case Kernel::AVX2:
+					return &SumAVX2;
+#endif
+				default:
+					return &SumScalar;
+			}
+		}
+		
+		
+		bool IsSupported(Kernel kernel)
+		{
+			switch(kernel)
+			{
+				case Kernel::Scalar:
+					return true;
+#if AR_HAS_X86_KERNELS
+				case Kernel::SSE2:
+					return __builtin_cpu_supports("sse2");
+				case Kernel::AVX2:
+					return __builtin_cpu_supports("avx2");
+#endif
+				default:
+					return false;
+			}
+		}
+		
+		Kernel GetKernel()
+		{
+			static const Kernel kernel = IsSupported(Kernel::AVX2) ? Kernel::AVX2 : (IsSupported(Kernel::SSE2) ? Kernel::SSE2 : Kernel::Scalar);
+			return kernel;
+		}
+		
+		const char *GetKernelName(Kernel kernel)
+		{
+			switch(kernel)
+			{
+				case Kernel::SSE2:
+					return "SSE2";
+				case Kernel::AVX2:
+					return "AVX2";
+				default:
+					return "Scalar";
+			}
+		}
+		
+		
+		uint32_t Sum(const uint8_t *data, size_t length)
+		{
+			static const SumFunction function = GetFunction(GetKernel());
+			return function(data, length);
+		}
+		
+		uint32_t Sum(Kernel kernel, const uint8_t *data, size_t length)
+		{
+			return GetFunction(kernel)(data, length);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+//
+//  ARChecksum.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARChecksum__
+#define __libARDrone__ARChecksum__
+
+#include <cstdint>
+#include <cstddef>
+
+namespace AR
+{
+	namespace Checksum
+	{
+		enum class Kernel
+		{
+			Scalar,
+			SSE2,
+			AVX2
+		};
+		
+		// Plain sum of all bytes, which is what the navdata checksum option carries.
+		// Uses the widest kernel the CPU supports, picked once on first use. An explicit kernel has to be supported
+		uint32_t Sum(const uint8_t *data, size_t length);
+		uint32_t Sum(Kernel kernel, const uint8_t *data, size_t length);
+		
+		Kernel GetKernel();
+		bool IsSupported(Kernel kernel);
+		const char *GetKernelName(Kernel kernel);
+	}
+}
+
+#endif /* defined(__libARDrone__ARChecksum__) */
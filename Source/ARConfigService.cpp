@@ -46,11 +46,23 @@ namespace AR
 	};
 	
 	
+	static Socket::Options ConfigSocketOptions()
+	{
+		// Small request and response exchanges, don't let Nagle hold them back
+		Socket::Options options;
+		options.noDelay = true;
+		
+		return options;
+	}
+	
 	ConfigService::ConfigService(Drone *drone, const std::string &address) :
 		Service(drone, "Config"),
-		_socket(new Socket(address, 5559, Socket::Type::TCP))
+		_socket(new Socket(address, 5559, Socket::Type::TCP, ConfigSocketOptions())),
+		_configReceived(false),
+		_configBroken(false)
 	{
-		
+		// Commands are only advanced when fresh navdata arrives
+		SetTickInterval(std::chrono::milliseconds(0));
 	}
 	
 	ConfigService::~ConfigService()
@@ -61,6 +73,10 @@ namespace AR
 	
 	Service::State ConfigService::ConnectInternal()
 	{
+		// When event driven the socket is only read once the reactor reports it readable, instead of blocking the loop
+		_socket->SetBlocking(!IsEventDriven());
+		_configBroken = false;
+		
 		if(!_socket->Connect())
 			return State::Disconnected;
 		
@@ -156,8 +172,8 @@ namespace AR
 		switch(command.state)
 		{
 			case CommandSendStateSend:
-				_atService->Send(ATCommand("CONFIG_ID") << "252f1910" << "de476a00" << "efc8fd84");
-				_atService->Send(ATCommand("CONFIG") << command.key << command.value);
+				SendCommand(AT::CONFIG_ID, "252f1910", "de476a00", "efc8fd84");
+				SendCommand(AT::CONFIG, command.key, command.value);
 				
 				command.state = CommandSendStateAck;
 				return CommandResult::Proceed;
@@ -169,7 +185,7 @@ namespace AR
 					return CommandResult::Failed;
 				}
 				
-				_atService->Send(ATCommand("CTRL") << ACK_CONTROL_MODE << 0);
+				SendCommand(AT::CTRL, ACK_CONTROL_MODE, 0);
 				command.state = CommandSendStateAckClear;
 				
 				return CommandResult::Proceed;
@@ -232,12 +248,14 @@ namespace AR
 			{
 				if(_droneState & ARDRONE_COMMAND_MASK)
 				{
-					_atService->Send(ATCommand("CTRL") << ACK_CONTROL_MODE << 0);
+					SendCommand(AT::CTRL, ACK_CONTROL_MODE, 0);
 					return CommandResult::Proceed;
 				}
 				
 				_configBuffer.clear();
-				_atService->Send(ATCommand("CTRL") << CFG_GET_CONTROL_MODE << 0);
+				_configReceived = false;
+				
+				SendCommand(AT::CTRL, CFG_GET_CONTROL_MODE, 0);
 				
 				command.state = 1;
 				
@@ -246,21 +264,9 @@ namespace AR
 				
 			case 1:
 			{
-				char buffer[1025];
-				size_t received;
+				bool failed = IsEventDriven() ? _configBroken : !ReceiveConfig();
 				
-				if(_socket->Receive(buffer, 1024, &received) == Socket::Result::Success)
-				{
-					buffer[1024] = '\0';
-					_configBuffer.append(buffer);
-					
-					if(buffer[received - 1] == '\0')
-					{
-						ParseConfig();
-						return CommandResult::Success;
-					}
-				}
-				else
+				if(failed)
 				{
 					if(!(_droneState & ACK_CONTROL_MODE))
 						command.state = 0;
@@ -268,6 +274,12 @@ namespace AR
 					return CommandResult::Failed;
 				}
 				
+				if(_configReceived)
+				{
+					ParseConfig();
+					return CommandResult::Success;
+				}
+				
 				return CommandResult::Proceed;
 			}
 		}
@@ -276,10 +288,35 @@ namespace AR
 		return CommandResult::Failed;
 	}
 	
+	bool ConfigService::ReceiveConfig()
+	{
+		char buffer[1024];
+		size_t received;
+		
+		Socket::Result result = _socket->Receive(buffer, 1024, &received);
+		
+		if(result == Socket::Result::WouldBlock)
+			return true;
+		if(result != Socket::Result::Success)
+			return false;
+		
+		_configBuffer.append(buffer, received);
+		
+		if(buffer[received - 1] == '\0')
+			_configReceived = true;
+		
+		return true;
+	}
+	
 	void ConfigService::Tick(uint32_t reason)
 	{
 		std::unique_lock<std::mutex> lock(_mutex);
 		
+		// Drained right away so the reactor doesn't spin on a readable socket while we wait for navdata.
+		// A failed stream stays readable, so it is dropped from the reactor until the next connect
+		if((reason & WakeupReason::Readable) && !ReceiveConfig())
+			_configBroken = true;
+		
 		if(_queue.empty())
 			return;
 		
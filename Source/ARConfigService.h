@@ -38,6 +38,7 @@ namespace AR
 	{
 	public:
 		friend class Drone;
+		friend class Benchmark;
 		
 		ConfigService(Drone *drone, const std::string &droneIP);
 		~ConfigService() override;
@@ -81,6 +82,9 @@ namespace AR
 		State ConnectInternal() final;
 		void DisconnectInternal() final;
 		
+		Socket *GetSocket() const final { return _socket; }
+		int GetDescriptor() const final { return _configBroken ? -1 : _socket->GetDescriptor(); }
+		
 	private:
 		void ProcessNavdata(Navdata *navdata);
 		
@@ -114,8 +118,20 @@ namespace AR
 		
 		CommandResult HandleSendConfig(Command &command);
 		CommandResult HandleRequestConfig(Command &command);
+		bool ReceiveConfig();
 		void ParseConfig();
 		
+		// Every step of the handshake expects its acknowledgement in the next navdata packet,
+		// so don't let a paced AT service hold the commands back
+		template<class... Arguments, class... Values>
+		void SendCommand(const AT::Descriptor<Arguments...> &descriptor, const Values &...values)
+		{
+			if(_atService->IsPaced())
+				_atService->SendImmediate(descriptor, values...);
+			else
+				_atService->Send(descriptor, values...);
+		}
+		
 		ATService *_atService;
 		Socket *_socket;
 		
@@ -128,6 +144,8 @@ namespace AR
 		bool _requestedConfig;
 		
 		std::string _configBuffer;
+		bool _configReceived;
+		bool _configBroken;
 	};
 }
 
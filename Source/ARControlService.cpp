@@ -23,6 +23,7 @@ namespace AR
 {
 	ControlService::ControlService(Drone *drone) :
 		Service(drone, "Control"),
+		_atService(nullptr),
 		_wantsTakeOff(false),
 		_emergency(false),
 		_wantsFtrim(false),
@@ -138,6 +139,8 @@ namespace AR
 		if(_wantsTakeOff && _flyState == FlyState::Flying)
 		{
 			_wantsTakeOff = false;
+			
+			SendReferenceNow();
 			Wakeup(WakeupReason::DataAvilable);
 		}
 	}
@@ -160,6 +163,7 @@ namespace AR
 		if(_emergency)
 			_wantsTakeOff = false;
 		
+		SendReferenceNow();
 		Wakeup(WakeupReason::DataAvilable);
 	}
 	
@@ -220,20 +224,30 @@ namespace AR
 	void ControlService::TickNow()
 	{
 		{
-			uint32_t data = _hover ? 0 : 1;
-			_atService->Send(ATCommand("PCMD") << data << _direction.x << _direction.z << _direction.y << _angularSpeed);
+			int32_t data = _hover ? 0 : 1;
+			_atService->Send(AT::PCMD, data, _direction.x, _direction.z, _direction.y, _angularSpeed);
 		}
 		
-		{
-			uint32_t data = (1 << 18) | (1 << 20) | (1 << 22) | (1 << 24) | (1 << 28);
-			
-			if(_wantsTakeOff)
-				data |= (1 << 9);
-			if(_emergency)
-				data |= (1 << 8);
-			
-			_atService->Send(ATCommand("REF") << data);
-		}
+		_atService->Send(AT::REF, GetReference());
+	}
+	
+	uint32_t ControlService::GetReference() const
+	{
+		uint32_t data = (1 << 18) | (1 << 20) | (1 << 22) | (1 << 24) | (1 << 28);
+		
+		if(_wantsTakeOff)
+			data |= (1 << 9);
+		if(_emergency)
+			data |= (1 << 8);
+		
+		return data;
+	}
+	
+	void ControlService::SendReferenceNow()
+	{
+		// Landing and emergencies skip the control tick and the AT queue
+		if(_atService && GetState() == State::Connected)
+			_atService->SendImmediate(AT::REF, GetReference());
 	}
 	
 	void ControlService::Tick(uint32_t reason)
@@ -244,12 +258,12 @@ namespace AR
 		{
 			// Keep the Drone entertained while we are waiting for Navdata
 			{
-				_atService->Send(ATCommand("PCMD") << 0 << 0.0f << 0.0f << 0.0f << 0.0f);
+				_atService->Send(AT::PCMD, 0, 0.0f, 0.0f, 0.0f, 0.0f);
 			}
 			
 			{
 				uint32_t data = (1 << 18) | (1 << 20) | (1 << 22) | (1 << 24) | (1 << 28);
-				_atService->Send(ATCommand("REF") << data);
+				_atService->Send(AT::REF, data);
 			}
 			
 			return;
@@ -258,14 +272,14 @@ namespace AR
 		if(_wantsFtrim)
 		{
 			if(_flyState == FlyState::Landed)
-				_atService->Send(ATCommand("FTRIM"));
+				_atService->Send(AT::FTRIM);
 			
 			_wantsFtrim = false;
 		}
 		
 		if(_wantsCalibration && _flyState == FlyState::Flying)
 		{
-			_atService->Send(ATCommand("CALIB") << 0);
+			_atService->Send(AT::CALIB, 0);
 			_wantsCalibration = false;
 		}
 		
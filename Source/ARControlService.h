@@ -73,6 +73,9 @@ namespace AR
 		void ProcessNavdata(Navdata *data);
 		void TickNow();
 		
+		uint32_t GetReference() const;
+		void SendReferenceNow();
+		
 		std::mutex _mutex;
 		std::chrono::steady_clock::time_point _lastPackage;
 		ATService *_atService;
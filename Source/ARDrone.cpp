@@ -16,15 +16,41 @@
 //  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 
+#include <algorithm>
 #include "ARDrone.h"
 
 namespace AR
 {
-	Drone::Drone(const std::string &droneIP) :
-		_droneIP(droneIP),
+	// The drones whose subscribers the current thread is calling, innermost first. A callback can update
+	// another drone that calls back into an outer one, so writers must not wait on any of them
+	struct DispatchFrame
+	{
+		const Drone *drone;
+		const DispatchFrame *outer;
+	};
+	
+	static thread_local const DispatchFrame *__dispatchFrames = nullptr;
+	
+	static bool IsDispatching(const Drone *drone)
+	{
+		for(const DispatchFrame *frame = __dispatchFrames; frame; frame = frame->outer)
+		{
+			if(frame->drone == drone)
+				return true;
+		}
+		
+		return false;
+	}
+	
+	Drone::Drone(const std::string &droneIP, Reactor *reactor) :
 		_state(State::Disconnected),
+		_droneIP(droneIP),
+		_reactor(reactor),
+		_replay(nullptr),
+		_navdataSubscriber(new NavdataSubscriberList()),
+		_hasRetiredSubscribers(false),
+		_subscriberEpoch(0),
 		_navdata(nullptr),
-		_freshData(false),
 		_navdataOptions(0)
 	{
 		_atService = new ATService(this, _droneIP);
@@ -34,6 +60,9 @@ namespace AR
 		_services.push_back(_atService);
 		_services.push_back(_navdataService);
 		_services.push_back(_configService);
+		
+		_subscriberReaders[0] = 0;
+		_subscriberReaders[1] = 0;
 	}
 	
 	Drone::~Drone()
@@ -43,6 +72,15 @@ namespace AR
 		delete _atService;
 		delete _navdataService;
 		delete _configService;
+		
+		Navdata *navdata = _navdata.exchange(nullptr);
+		if(navdata)
+			navdata->Release();
+		
+		for(const NavdataSubscriberList *list : _retiredSubscribers)
+			delete list;
+		
+		delete _navdataSubscriber.load();
 	}
 	
 	
@@ -91,12 +129,14 @@ namespace AR
 		
 		_demoFlag = false;
 		
+		UpdateTaps();
+		
 		_atService->Connect();
 		_navdataService->Connect();
 		
 		// These are not documented but send by the AR Drone at startup. So we just copy them
-		_atService->Send(ATCommand("PMODE") << 2);
-		_atService->Send(ATCommand("MISC") << 2 << 20 << 2000 << 3000);
+		_atService->Send(AT::PMODE, 2);
+		_atService->Send(AT::MISC, 2, 20, 2000, 3000);
 		
 		// Fetch the config
 		_configService->Connect();
@@ -133,6 +173,50 @@ namespace AR
 	}
 	
 	
+	bool Drone::StartCapture(const std::string &path)
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		
+		if(!_capture.Open(path))
+			return false;
+		
+		UpdateTaps();
+		return true;
+	}
+	
+	void Drone::StopCapture()
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		
+		_capture.Close();
+		
+		// Detached so that a tapped socket, like video bypassing io_uring, goes back to its fast path
+		UpdateTaps();
+	}
+	
+	void Drone::SetReplay(Replay *replay)
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		_replay = replay;
+	}
+	
+	void Drone::UpdateTaps()
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		
+		for(Service *service : _services)
+		{
+			Socket *socket = service->GetSocket();
+			
+			if(socket)
+			{
+				socket->SetCapture(_capture.IsOpen() ? &_capture : nullptr);
+				socket->SetReplay(_replay);
+			}
+		}
+	}
+	
+	
 	
 	bool Drone::Update()
 	{
@@ -162,7 +246,7 @@ namespace AR
 			
 			if(hasConnecting)
 			{
-				long time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _lastMessage).count();
+				long time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _lastMessage.load(std::memory_order_relaxed)).count();
 				if(time >= 2100)
 				{
 					_state = State::ConnectionFailed;
@@ -196,57 +280,185 @@ namespace AR
 			
 			for(Service *service : _services)
 				service->Update();
-			
-			if(_freshData)
-			{
-				if(_state == State::Connected)
-				{
-					for(auto &data : _navdataSubscriber)
-						data.first(_navdata);
-				}
-				else
-				{
-					// Only send navdata to the services
-					for(auto &data : _navdataSubscriber)
-					{
-						for(Service *service : _services)
-						{
-							if(data.second == service)
-							{
-								data.first(_navdata);
-								break;
-							}
-						}
-					}
-				}
-				
-				_freshData = false;
-			}
 		}
 		
+		// Callbacks run without _lock, so they can't stall anything but the thread calling Update()
+		Navdata *navdata = _navdata.exchange(nullptr, std::memory_order_acquire);
+		
+		if(navdata)
+		{
+			DispatchNavdata(navdata);
+			navdata->Release();
+		}
+		
+		// Lists replaced from inside callbacks couldn't be freed right away
+		if(_hasRetiredSubscribers.load(std::memory_order_relaxed) && !IsDispatching(this))
+			ReclaimSubscribers();
+		
 		std::this_thread::yield();
 		return true;
 	}
 	
 	
-	void Drone::AddNavdataSubscriber(std::function<void (Navdata *)> &&function, void *token)
+	void Drone::AddNavdataSubscriber(std::function<void (Navdata *)> &&function, void *token, uint32_t options, std::chrono::microseconds interval)
 	{
-		std::lock_guard<std::recursive_mutex> lock(_lock);
-		_navdataSubscriber.push_back(std::make_pair(std::move(function), token));
+		std::shared_ptr<NavdataSubscriber> subscriber = std::make_shared<NavdataSubscriber>();
+		subscriber->function = std::move(function);
+		subscriber->token    = token;
+		subscriber->options  = options;
+		subscriber->interval = interval;
+		subscriber->next     = std::chrono::steady_clock::time_point();
+		subscriber->removed  = false;
+		
+		{
+			std::lock_guard<std::mutex> lock(_subscriberLock);
+			
+			NavdataSubscriberList *list = new NavdataSubscriberList(*_navdataSubscriber.load(std::memory_order_relaxed));
+			list->push_back(std::move(subscriber));
+			
+			PublishSubscribers(list);
+		}
+		
+		// Inside a callback the old list is still being walked by this very thread, Update() frees it later
+		if(!IsDispatching(this))
+			ReclaimSubscribers();
 	}
 	
 	void Drone::RemoveNavdataSubscriber(void *token)
 	{
-		std::lock_guard<std::recursive_mutex> lock(_lock);
-		
-		for(auto i = _navdataSubscriber.begin(); i != _navdataSubscriber.end(); i ++)
 		{
-			if(i->second == token)
-			{
-				_navdataSubscriber.erase(i);
+			std::lock_guard<std::mutex> lock(_subscriberLock);
+			
+			const NavdataSubscriberList *current = _navdataSubscriber.load(std::memory_order_relaxed);
+			auto iterator = std::find_if(current->begin(), current->end(), [&](const std::shared_ptr<NavdataSubscriber> &subscriber) {
+				return subscriber->token == token;
+			});
+			
+			if(iterator == current->end())
 				return;
-			}
+			
+			(*iterator)->removed.store(true, std::memory_order_relaxed);
+			
+			NavdataSubscriberList *list = new NavdataSubscriberList(*current);
+			list->erase(list->begin() + (iterator - current->begin()));
+			
+			PublishSubscribers(list);
+		}
+		
+		// Once the old list is reclaimed, no callback of the removed subscriber can still be running
+		if(!IsDispatching(this))
+			ReclaimSubscribers();
+	}
+	
+	void Drone::PublishSubscribers(NavdataSubscriberList *list)
+	{
+		const NavdataSubscriberList *previous = _navdataSubscriber.exchange(list, std::memory_order_acq_rel);
+		
+		_retiredSubscribers.push_back(previous);
+		_hasRetiredSubscribers.store(true, std::memory_order_relaxed);
+	}
+	
+	void Drone::ReclaimSubscribers()
+	{
+		// Waiting happens without _subscriberLock, a callback that is waited for might want to take it
+		std::lock_guard<std::mutex> lock(_reclaimLock);
+		std::vector<const NavdataSubscriberList *> retired;
+		
+		{
+			std::lock_guard<std::mutex> lock(_subscriberLock);
+			
+			retired.swap(_retiredSubscribers);
+			_hasRetiredSubscribers.store(false, std::memory_order_relaxed);
 		}
+		
+		WaitForDispatch();
+		
+		for(const NavdataSubscriberList *list : retired)
+			delete list;
+	}
+	
+	void Drone::WaitForDispatch()
+	{
+		// Flip the epoch so new dispatches count towards the other reader slot, then wait for the old slot to
+		// drain. The first wait covers dispatches that entered before the previous flip and are still around
+		uint32_t epoch = _subscriberEpoch.load();
+		
+		while(_subscriberReaders[(epoch + 1) & 1].load() != 0)
+			std::this_thread::yield();
+		
+		_subscriberEpoch.store(epoch + 1);
+		
+		while(_subscriberReaders[epoch & 1].load() != 0)
+			std::this_thread::yield();
+	}
+	
+	uint32_t Drone::EnterDispatch()
+	{
+		while(1)
+		{
+			uint32_t epoch = _subscriberEpoch.load();
+			_subscriberReaders[epoch & 1].fetch_add(1);
+			
+			// A writer flipped the epoch in between and might not have seen us, count towards the new one
+			if(_subscriberEpoch.load() == epoch)
+				return epoch;
+			
+			_subscriberReaders[epoch & 1].fetch_sub(1);
+		}
+	}
+	
+	void Drone::LeaveDispatch(uint32_t epoch)
+	{
+		_subscriberReaders[epoch & 1].fetch_sub(1, std::memory_order_release);
+	}
+	
+	void Drone::DispatchNavdata(Navdata *navdata)
+	{
+		DispatchFrame frame = { this, __dispatchFrames };
+		__dispatchFrames = &frame;
+		
+		uint32_t epoch = EnterDispatch();
+		const NavdataSubscriberList *list = _navdataSubscriber.load(std::memory_order_acquire);
+		
+		// Until connected, only the services get navdata. Services are only ever added while disconnected,
+		// so reading the list without _lock is fine here
+		bool servicesOnly = (_state != State::Connected);
+		
+		for(const std::shared_ptr<NavdataSubscriber> &subscriber : *list)
+		{
+			if(!subscriber->Wants(navdata))
+				continue;
+			
+			if(servicesOnly && std::find(_services.begin(), _services.end(), subscriber->token) == _services.end())
+				continue;
+			
+			subscriber->Deliver(navdata);
+		}
+		
+		LeaveDispatch(epoch);
+		__dispatchFrames = frame.outer;
+	}
+	
+	
+	bool Drone::NavdataSubscriber::Wants(const Navdata *navdata) const
+	{
+		return navdata->HasOptions(options) && navdata->timestamp >= next.load(std::memory_order_relaxed) && !removed.load(std::memory_order_relaxed);
+	}
+	
+	void Drone::NavdataSubscriber::Deliver(Navdata *navdata)
+	{
+		if(interval.count() > 0)
+		{
+			// Stick to the grid so the average rate is exact, unless we fell behind by more than a whole interval
+			std::chrono::steady_clock::time_point deadline = next.load(std::memory_order_relaxed) + interval;
+			
+			if(deadline <= navdata->timestamp)
+				deadline = navdata->timestamp + interval;
+			
+			next.store(deadline, std::memory_order_relaxed);
+		}
+		
+		function(navdata);
 	}
 	
 	
@@ -283,13 +495,12 @@ namespace AR
 			}
 		}
 		
-		std::lock_guard<std::recursive_mutex> lock(_lock);
-		delete _navdata;
-		
-		_navdata   = data;
-		_freshData = true;
+		_lastMessage.store(data->timestamp, std::memory_order_relaxed);
 		
-		_lastMessage = std::chrono::steady_clock::now();
+		// Never waits on Update(), a packet it didn't get to in time is simply replaced by the newer one
+		Navdata *previous = _navdata.exchange(data, std::memory_order_acq_rel);
+		if(previous)
+			previous->Release();
 	}
 	
 	// Configuration
@@ -23,8 +23,12 @@
 #include <string>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <memory>
 #include <vector>
 
+#include "ARReactor.h"
+#include "ARCapture.h"
 #include "ARATService.h"
 #include "ARNavdataService.h"
 #include "ARControlService.h"
@@ -40,6 +44,7 @@ namespace AR
 		friend class Service;
 		friend class NavdataService;
 		friend class ATService;
+		friend class Benchmark;
 		
 		enum class State
 		{
@@ -55,7 +60,8 @@ namespace AR
 			Freuqency25 = 8
 		};
 		
-		Drone(const std::string &droneIP);
+		// With a reactor, all services are driven by its event loop instead of their own threads
+		Drone(const std::string &droneIP, Reactor *reactor = nullptr);
 		~Drone();
 		
 		void ConnectAsync();
@@ -84,7 +90,11 @@ namespace AR
 		void SetSSID(const std::string &ssid);
 		void SetName(const std::string &name);
 		
-		void AddNavdataSubscriber(std::function<void(Navdata *data)> &&function, void *token);
+		// The packet is only valid during the callback, retain it to keep it around.
+		// Packets that lack any of the options in the mask are skipped, and so is everything arriving sooner
+		// than interval after the last delivery, ie. std::chrono::seconds(1) for at most 1 Hz.
+		// Both may be called from inside a callback. Outside of one, removing waits for running callbacks to return
+		void AddNavdataSubscriber(std::function<void(Navdata *data)> &&function, void *token, uint32_t options = 0, std::chrono::microseconds interval = std::chrono::microseconds(0));
 		void RemoveNavdataSubscriber(void *token);
 		
 		State GetState() const { return _state.load(); }
@@ -96,16 +106,56 @@ namespace AR
 		}
 		
 		const std::string &GetDroneIP() const { return _droneIP; }
+		Reactor *GetReactor() const { return _reactor; }
+		
+		// Records the traffic of all services into a capture file until StopCapture() is called
+		bool StartCapture(const std::string &path);
+		void StopCapture();
+		
+		// Talks to the replay instead of the drone on the next connect, the replay has to outlive the connection.
+		// Replays only work with threaded services
+		void SetReplay(Replay *replay);
 		
 	private:
+		struct NavdataSubscriber
+		{
+			std::function<void(Navdata *data)> function;
+			void *token;
+			
+			uint32_t options;
+			std::chrono::steady_clock::duration interval;
+			std::atomic<std::chrono::steady_clock::time_point> next;
+			
+			// Set on removal, a dispatch that is already walking an older list skips it from then on
+			std::atomic<bool> removed;
+			
+			bool Wants(const Navdata *navdata) const;
+			void Deliver(Navdata *navdata);
+		};
+		
+		// Shared between the list snapshots, so a copy keeps the rate limiting state
+		typedef std::vector<std::shared_ptr<NavdataSubscriber>> NavdataSubscriberList;
+		
 		Service *AddService(Service *service);
 		Service *GetService(const std::string &name);
 		
 		void PublishNavdata(Navdata *data);
+		void DispatchNavdata(Navdata *data);
+		
+		uint32_t EnterDispatch();
+		void LeaveDispatch(uint32_t epoch);
+		
+		// Expects _subscriberLock to be held, ReclaimSubscribers() and WaitForDispatch() expect it not to be
+		void PublishSubscribers(NavdataSubscriberList *list);
+		void ReclaimSubscribers();
+		void WaitForDispatch();
+		
 		void SetNeedsNavdataOptionsUpdate();
+		void UpdateTaps();
 		
 		std::atomic<State> _state;
 		std::string _droneIP;
+		Reactor *_reactor;
 		
 		std::string _sessionID;
 		std::string _applicationID;
@@ -113,16 +163,31 @@ namespace AR
 		
 		std::vector<Service *> _services;
 		
+		Capture _capture;
+		Replay *_replay;
+		
 		ATService *_atService;
 		NavdataService *_navdataService;
 		ConfigService *_configService;
 		
-		std::chrono::steady_clock::time_point _lastMessage;
+		std::atomic<std::chrono::steady_clock::time_point> _lastMessage;
 		
 		std::recursive_mutex _lock;
-		std::vector<std::pair<std::function<void(Navdata *data)>, void *>> _navdataSubscriber;
-		Navdata *_navdata;
-		bool _freshData;
+		
+		// The subscriber list is read-copy-update. Dispatch reads the current list without any lock, while
+		// writers copy it and swap the copy in. A replaced list is freed once every dispatch that might
+		// still walk it has left, tracked by a reader count for each of two alternating epochs
+		std::mutex _subscriberLock;
+		std::mutex _reclaimLock;
+		std::atomic<const NavdataSubscriberList *> _navdataSubscriber;
+		std::vector<const NavdataSubscriberList *> _retiredSubscribers;
+		std::atomic<bool> _hasRetiredSubscribers;
+		
+		std::atomic<uint32_t> _subscriberEpoch;
+		std::atomic<uint32_t> _subscriberReaders[2];
+		
+		// Newest packet that Update() hasn't picked up yet, swapped in and out without taking _lock
+		std::atomic<Navdata *> _navdata;
 		
 		bool _demoFlag;
 		bool _needsNavdataOptionsUpdate;
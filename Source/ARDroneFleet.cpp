@@ -0,0 +1,334 @@
+//
+//  ARDroneFleet.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm>
+#include "ARDroneFleet.h"
+
+namespace AR
+{
+	// The fleet whose executor is the current thread, it must not wait for its own rounds
+	static thread_local const DroneFleet *__executingFleet = nullptr;
+	
+	DroneFleet::Options::Options() :
+		reactors(2),
+		videoBufferSize(4 * 1024 * 1024),
+		ephemeralPorts(true),
+		updateInterval(5)
+	{}
+	
+	
+	DroneFleet::DroneFleet(const Options &options) :
+		_options(options),
+		_nextReactor(0),
+		_running(true),
+		_rounds(0)
+	{
+		size_t count = std::max<size_t>(_options.reactors, 1);
+		
+		for(size_t i = 0; i < count; i ++)
+			_reactors.emplace_back(new Reactor());
+		
+		_executor = std::move(std::thread(&DroneFleet::ExecutorHandler, this));
+	}
+	
+	DroneFleet::~DroneFleet()
+	{
+		DisconnectAll();
+		
+		_running = false;
+		_executor.join();
+		
+		for(auto &entry : _entries)
+			delete entry->drone;
+		for(auto &entry : _removed)
+			delete entry->drone;
+		
+		_entries.clear();
+		_removed.clear();
+	}
+	
+	
+	Drone *DroneFleet::AddDrone(const std::string &address)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		// Drones are spread round robin, a reactor that isn't valid makes its drones fall back to threads
+		Reactor *reactor = _reactors[_nextReactor].get();
+		_nextReactor = (_nextReactor + 1) % _reactors.size();
+		
+		std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+		entry->drone = new Drone(address, reactor);
+		entry->connecting = false;
+		entry->removed = false;
+		entry->navdata = 0;
+		
+		Entry *temp = entry.get();
+		entry->drone->AddNavdataSubscriber([temp](Navdata *) {
+			temp->navdata.fetch_add(1, std::memory_order_relaxed);
+		}, temp);
+		
+		_entries.push_back(entry);
+		return entry->drone;
+	}
+	
+	void DroneFleet::RemoveDrone(Drone *drone)
+	{
+		std::shared_ptr<Entry> entry;
+		
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			
+			auto iterator = std::find_if(_entries.begin(), _entries.end(), [&](const std::shared_ptr<Entry> &entry) {
+				return entry->drone == drone;
+			});
+			
+			if(iterator == _entries.end())
+				return;
+			
+			entry = *iterator;
+			_entries.erase(iterator);
+			
+			entry->removed = true;
+			
+			// The executor can't wait for its own round to end, it deletes the drone once the round is over
+			if(__executingFleet == this)
+			{
+				_removed.push_back(entry);
+				return;
+			}
+		}
+		
+		// The executor might still be inside of Update(), wait for its round to end
+		uint64_t round = _rounds.load();
+		while(_rounds.load() < round + 2 && _running)
+			std::this_thread::yield();
+		
+		delete entry->drone;
+	}
+	
+	size_t DroneFleet::GetDroneCount()
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		return _entries.size();
+	}
+	
+	Drone *DroneFleet::GetDrone(size_t index)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		return (index < _entries.size()) ? _entries[index]->drone : nullptr;
+	}
+	
+	
+	void DroneFleet::Prepare(Entry *entry)
+	{
+		Drone *drone = entry->drone;
+		
+		const char *services[] = { "AT", "Navdata" };
+		
+		for(const char *name : services)
+		{
+			Service *service = drone->GetService<Service>(name);
+			Socket::Options options = service->GetSocketOptions();
+			
+			// Without ephemeral ports every drone of the fleet binds 5554 and 5556
+			options.reuseAddress = true;
+			
+			if(_options.ephemeralPorts)
+				options.localPort = 0;
+			
+			service->SetSocketOptions(options);
+		}
+		
+		VideoService *video = drone->GetService<VideoService>("Video");
+		if(video)
+			video->SetBufferSize(_options.videoBufferSize);
+	}
+	
+	void DroneFleet::ConnectAllAsync()
+	{
+		std::vector<std::shared_ptr<Entry>> entries;
+		
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			
+			for(auto &entry : _entries)
+			{
+				if(entry->drone->GetState() != Drone::State::Connected && entry->drone->GetState() != Drone::State::Connecting)
+				{
+					// Keeps the executor away from the drone while its services are still being connected
+					entry->connecting = true;
+					entries.push_back(entry);
+				}
+			}
+		}
+		
+		// Connecting blocks on the TCP handshakes, so spread it over as many threads as there are reactors
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> threads;
+		
+		auto worker = [&]() {
+			
+			size_t index;
+			
+			while((index = next.fetch_add(1)) < entries.size())
+			{
+				Entry *entry = entries[index].get();
+				
+				if(entry->drone->GetState() != Drone::State::Disconnected)
+					entry->drone->Disconnect();
+				
+				Prepare(entry);
+				entry->drone->ConnectAsync();
+				
+				entry->connecting = false;
+			}
+		};
+		
+		size_t count = std::min(_reactors.size(), entries.size());
+		
+		for(size_t i = 1; i < count; i ++)
+			threads.emplace_back(worker);
+		
+		worker();
+		
+		for(std::thread &thread : threads)
+			thread.join();
+	}
+	
+	bool DroneFleet::ConnectAll(std::chrono::milliseconds timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		
+		ConnectAllAsync();
+		
+		while(std::chrono::steady_clock::now() < deadline)
+		{
+			Statistics statistics = GetStatistics();
+			
+			if(statistics.connecting == 0)
+				return (statistics.connected == statistics.drones);
+			
+			std::this_thread::sleep_for(_options.updateInterval);
+		}
+		
+		return false;
+	}
+	
+	void DroneFleet::DisconnectAll()
+	{
+		std::vector<std::shared_ptr<Entry>> entries;
+		
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			entries = _entries;
+			
+			for(auto &entry : entries)
+				entry->connecting = true;
+		}
+		
+		for(auto &entry : entries)
+		{
+			entry->drone->Disconnect();
+			entry->connecting = false;
+		}
+	}
+	
+	
+	DroneFleet::Statistics DroneFleet::GetStatistics()
+	{
+		Statistics statistics = {};
+		
+		std::lock_guard<std::mutex> lock(_lock);
+		
+		for(auto &entry : _entries)
+		{
+			Drone *drone = entry->drone;
+			
+			statistics.navdataReceived += entry->navdata.load(std::memory_order_relaxed);
+			statistics.navdataSkipped  += drone->GetService<NavdataService>("Navdata")->GetSkippedPackets();
+			
+			// A drone that is being connected still reports the state of its last attempt
+			if(entry->connecting)
+			{
+				statistics.connecting ++;
+				continue;
+			}
+			
+			switch(drone->GetState())
+			{
+				case Drone::State::Connected:
+					statistics.connected ++;
+					break;
+				case Drone::State::Connecting:
+					statistics.connecting ++;
+					break;
+				case Drone::State::ConnectionFailed:
+					statistics.failed ++;
+					break;
+				default:
+					break;
+			}
+		}
+		
+		for(auto &reactor : _reactors)
+			statistics.services += reactor->GetServiceCount();
+		
+		statistics.drones = _entries.size();
+		statistics.updateRounds = _rounds.load(std::memory_order_relaxed);
+		
+		return statistics;
+	}
+	
+	
+	void DroneFleet::ExecutorHandler()
+	{
+		std::vector<std::shared_ptr<Entry>> entries;
+		std::vector<std::shared_ptr<Entry>> removed;
+		
+		__executingFleet = this;
+		
+		while(_running)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				entries = _entries;
+			}
+			
+			for(auto &entry : entries)
+			{
+				if(!entry->connecting && !entry->removed)
+					entry->drone->Update();
+			}
+			
+			entries.clear();
+			
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				std::swap(removed, _removed);
+			}
+			
+			for(auto &entry : removed)
+				delete entry->drone;
+			
+			removed.clear();
+			_rounds.fetch_add(1, std::memory_order_release);
+			
+			std::this_thread::sleep_for(_options.updateInterval);
+		}
+	}
+}
@@ -0,0 +1,110 @@
+//
+//  ARDroneFleet.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARDroneFleet__
+#define __libARDrone__ARDroneFleet__
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "ARDrone.h"
+#include "ARReactor.h"
+
+namespace AR
+{
+	// Runs many drones in one process. Instead of a thread per service, all drones share a small
+	// pool of reactors for their I/O and timers, and a single executor thread calls Update() on
+	// every drone, so all navdata and video subscribers run on that thread.
+	class DroneFleet
+	{
+	public:
+		struct Options
+		{
+			Options();
+			
+			size_t reactors; // Number of I/O threads
+			size_t videoBufferSize; // Per drone, the Video service holds about twice that
+			bool ephemeralPorts; // Bind UDP sockets to ephemeral ports so drones don't fight over 5554 and 5556
+			std::chrono::milliseconds updateInterval; // Time the executor sleeps between two rounds
+		};
+		
+		struct Statistics
+		{
+			size_t drones;
+			size_t connected;
+			size_t connecting;
+			size_t failed;
+			size_t services;
+			
+			uint64_t navdataReceived;
+			uint64_t navdataSkipped;
+			uint64_t updateRounds;
+		};
+		
+		DroneFleet(const Options &options = Options());
+		~DroneFleet();
+		
+		// Drones are owned by the fleet. Services can be added until the drone is connected.
+		// Removing a drone from one of the subscribers defers deleting it to the end of the round
+		Drone *AddDrone(const std::string &address);
+		void RemoveDrone(Drone *drone);
+		
+		size_t GetDroneCount();
+		Drone *GetDrone(size_t index);
+		
+		// Connects all disconnected drones in parallel, the executor finishes the handshakes
+		void ConnectAllAsync();
+		// Returns true if every drone is connected before the timeout
+		bool ConnectAll(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+		void DisconnectAll();
+		
+		Statistics GetStatistics();
+		
+	private:
+		struct Entry
+		{
+			Drone *drone;
+			std::atomic<bool> connecting;
+			std::atomic<bool> removed;
+			std::atomic<uint64_t> navdata;
+		};
+		
+		void Prepare(Entry *entry);
+		void ExecutorHandler();
+		
+		Options _options;
+		
+		std::vector<std::unique_ptr<Reactor>> _reactors;
+		size_t _nextReactor;
+		
+		std::mutex _lock;
+		std::vector<std::shared_ptr<Entry>> _entries;
+		std::vector<std::shared_ptr<Entry>> _removed;
+		
+		std::atomic<bool> _running;
+		std::atomic<uint64_t> _rounds;
+		std::thread _executor;
+	};
+}
+
+#endif /* defined(__libARDrone__ARDroneFleet__) */
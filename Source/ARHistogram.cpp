@@ -0,0 +1,114 @@
+//
+//  ARHistogram.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "ARHistogram.h"
+
+namespace AR
+{
+	Histogram::Histogram()
+	{
+		Reset();
+	}
+	
+	void Histogram::Reset()
+	{
+		for(size_t i = 0; i < kBuckets; i ++)
+			_buckets[i].store(0, std::memory_order_relaxed);
+		
+		_count.store(0, std::memory_order_relaxed);
+		_sum.store(0, std::memory_order_relaxed);
+		_max.store(0, std::memory_order_relaxed);
+	}
+	
+	
+	size_t Histogram::GetBucket(uint64_t value)
+	{
+		// Values below 16 get a bucket each, above that the three bits after the leading one pick the sub bucket
+		if(value < 16)
+			return static_cast<size_t>(value);
+		
+		size_t exponent = 63 - __builtin_clzll(value);
+		size_t sub = (value >> (exponent - 3)) & (kSubBuckets - 1);
+		
+		return 16 + (exponent - 4) * kSubBuckets + sub;
+	}
+	
+	uint64_t Histogram::GetBucketValue(size_t bucket)
+	{
+		if(bucket < 16)
+			return bucket;
+		
+		size_t exponent = (bucket - 16) / kSubBuckets + 4;
+		uint64_t sub = (bucket - 16) % kSubBuckets;
+		
+		// Middle of the bucket
+		uint64_t lower = (uint64_t(1) << exponent) | (sub << (exponent - 3));
+		return lower + (uint64_t(1) << (exponent - 4));
+	}
+	
+	
+	void Histogram::Record(std::chrono::nanoseconds duration)
+	{
+		uint64_t value = (duration.count() > 0) ? static_cast<uint64_t>(duration.count()) : 0;
+		
+		_buckets[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+		
+		uint64_t max = _max.load(std::memory_order_relaxed);
+		while(value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		{}
+	}
+	
+	std::chrono::nanoseconds Histogram::GetMean() const
+	{
+		uint64_t count = GetCount();
+		return std::chrono::nanoseconds(count ? _sum.load(std::memory_order_relaxed) / count : 0);
+	}
+	
+	std::chrono::nanoseconds Histogram::GetPercentile(double percentile) const
+	{
+		uint64_t total = 0;
+		
+		for(size_t i = 0; i < kBuckets; i ++)
+			total += _buckets[i].load(std::memory_order_relaxed);
+		
+		if(total == 0)
+			return std::chrono::nanoseconds(0);
+		
+		uint64_t rank = static_cast<uint64_t>((percentile / 100.0) * total + 0.5);
+		rank = (rank < 1) ? 1 : ((rank > total) ? total : rank);
+		
+		uint64_t seen = 0;
+		
+		for(size_t i = 0; i < kBuckets; i ++)
+		{
+			seen += _buckets[i].load(std::memory_order_relaxed);
+			
+			if(seen >= rank)
+			{
+				uint64_t value = GetBucketValue(i);
+				uint64_t max = _max.load(std::memory_order_relaxed);
+				
+				return std::chrono::nanoseconds((value < max) ? value : max);
+			}
+		}
+		
+		return GetMax();
+	}
+}
@@ -0,0 +1,60 @@
+//
+//  ARHistogram.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARHistogram__
+#define __libARDrone__ARHistogram__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace AR
+{
+	// Log-linear histogram of durations, every power of two is split into eight buckets so
+	// percentiles are within 12.5% of the real value. Recording is lock-free and wait-free.
+	class Histogram
+	{
+	public:
+		Histogram();
+		
+		void Record(std::chrono::nanoseconds duration);
+		void Reset();
+		
+		uint64_t GetCount() const { return _count.load(std::memory_order_relaxed); }
+		std::chrono::nanoseconds GetMax() const { return std::chrono::nanoseconds(_max.load(std::memory_order_relaxed)); }
+		std::chrono::nanoseconds GetMean() const;
+		
+		// percentile in [0, 100], returns zero while empty
+		std::chrono::nanoseconds GetPercentile(double percentile) const;
+		
+	private:
+		static const size_t kSubBuckets = 8;
+		static const size_t kBuckets = 16 + (64 - 4) * kSubBuckets;
+		
+		static size_t GetBucket(uint64_t value);
+		static uint64_t GetBucketValue(size_t bucket);
+		
+		std::atomic<uint64_t> _buckets[kBuckets];
+		std::atomic<uint64_t> _count;
+		std::atomic<uint64_t> _sum;
+		std::atomic<uint64_t> _max;
+	};
+}
+
+#endif /* defined(__libARDrone__ARHistogram__) */
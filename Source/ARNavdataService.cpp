@@ -20,6 +20,7 @@
 
 #include "ARNavdataService.h"
 #include "ARDrone.h"
+#include "ARChecksum.h"
 
 namespace AR
 {
@@ -33,19 +34,67 @@ namespace AR
 		uint8_t data[];
 	} __attribute__((packed));
 	
+	static Socket::Options NavdataSocketOptions()
+	{
+		// Room for a few hundred milliseconds of navdata in case the thread gets descheduled
+		Socket::Options options;
+		options.receiveBufferSize = 256 * 1024;
+		options.typeOfService = Socket::Options::kTOSExpedited;
+		
+		return options;
+	}
+	
 	NavdataService::NavdataService(Drone *drone, const std::string &address) :
 		Service(drone, "Navdata"),
-		_socket(new Socket(address, 5554))
-	{}
+		_socket(new Socket(address, 5554, Socket::Type::UDP, NavdataSocketOptions())),
+		_viewMode(false),
+		_skippedPackets(0),
+		_received(0),
+		_published(0),
+		_malformed(0),
+		_checksumFailures(0),
+		_lost(0),
+		_reordered(0),
+		_duplicates(0),
+		_timeouts(0),
+		_opens(0),
+		_firstSequence(0),
+		_newestSequence(0),
+		_sequenceWindow(0),
+		_lastInterval(0)
+	{
+		_buffer = new uint8_t[kBatchSize * kDatagramSize];
+		
+		// Enough for the receive batch plus a few packets that are held by subscribers
+		_pool = new NavdataBufferPool(kBatchSize * 2);
+		_navdataPool = new Pool<Navdata>(8);
+		
+		for(size_t i = 0; i < kBatchSize; i ++)
+			_buffers[i] = _pool->Acquire();
+		
+		// Receive blocks on its own, the interval only matters for detecting timeouts when event driven
+		SetCanSleep(false);
+		SetTickInterval(std::chrono::milliseconds(250));
+	}
 	
 	NavdataService::~NavdataService()
 	{
 		delete _socket;
+		delete [] _buffer;
+		
+		for(size_t i = 0; i < kBatchSize; i ++)
+			_buffers[i]->Release();
+		
+		// Buffers and packets that are still referenced keep their pool alive
+		_pool->Release();
+		_navdataPool->Release();
 	}
 	
 	
 	Service::State NavdataService::ConnectInternal()
 	{
+		_socket->SetBlocking(!IsEventDriven());
+		
 		if(!_socket->Connect())
 			return State::Disconnected;
 		
@@ -65,127 +114,323 @@ namespace AR
 		
 		_socket->Send(&flag, sizeof(flag));
 		_sequence = 0;
+		_lastReceive = std::chrono::steady_clock::now();
+		
+		// The drone restarts its sequence numbers for a new stream
+		_firstSequence  = 0;
+		_newestSequence = 0;
+		_sequenceWindow = 0;
+		_lastArrival  = Socket::Timestamp();
+		_lastInterval = std::chrono::nanoseconds(0);
+		
+		_opens.fetch_add(1, std::memory_order_relaxed);
 	}
 	
-	uint32_t NavdataService::CalculateChecksum(const uint8_t *data, size_t size) const
+	void NavdataService::RecordArrival(const uint8_t *buffer, size_t length, Socket::Timestamp timestamp)
 	{
-		uint32_t checksum = 0;
+		const __NavdataRaw *raw = reinterpret_cast<const __NavdataRaw *>(buffer);
+		
+		_received.fetch_add(1, std::memory_order_relaxed);
 		
-		for(size_t i = 0; i < size; i ++)
+		if(length < sizeof(__NavdataRaw) || raw->header != 0x55667788)
 		{
-			checksum += data[i];
+			_malformed.fetch_add(1, std::memory_order_relaxed);
+			return;
 		}
 		
-		return checksum;
+		uint32_t sequence = raw->sequence;
+		bool first = (_sequenceWindow == 0);
+		
+		if(!first && sequence <= _newestSequence)
+		{
+			// Nothing before the first packet of the stream was counted as lost
+			uint32_t age = _newestSequence - sequence;
+			uint64_t bit = (age < 64 && sequence >= _firstSequence) ? (UINT64_C(1) << age) : 0;
+			
+			if(_sequenceWindow & bit)
+			{
+				_duplicates.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			
+			// Late but filled a gap that was already counted as lost. Anything older than the window can't be
+			// told apart from a duplicate and is counted as reordered either way
+			if(bit)
+			{
+				_sequenceWindow |= bit;
+				_lost.fetch_sub(1, std::memory_order_relaxed);
+			}
+			
+			_reordered.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		
+		if(first)
+			_firstSequence = sequence;
+		
+		uint32_t missing = first ? 0 : (sequence - _newestSequence - 1);
+		uint32_t shift = first ? 0 : (sequence - _newestSequence);
+		
+		_sequenceWindow = ((shift < 64) ? (_sequenceWindow << shift) : 0) | 1;
+		_newestSequence = sequence;
+		
+		if(missing > 0)
+			_lost.fetch_add(missing, std::memory_order_relaxed);
+		
+		if(_lastArrival != Socket::Timestamp())
+		{
+			std::chrono::nanoseconds interval = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - _lastArrival);
+			_arrivalInterval.Record(interval);
+			
+			if(missing == 0 && _lastInterval.count() > 0)
+				_arrivalJitter.Record((interval > _lastInterval) ? (interval - _lastInterval) : (_lastInterval - interval));
+			
+			_lastInterval = (missing == 0) ? interval : std::chrono::nanoseconds(0);
+		}
+		
+		_lastArrival = timestamp;
 	}
 	
-	void NavdataService::Tick(uint32_t reason)
+	NavdataService::Statistics NavdataService::GetStatistics() const
 	{
-		union
-		{
-			uint8_t buffer[4096];
-			__NavdataRaw data;
-		} bridge;
+		Statistics statistics;
 		
-		if(!_opened)
+		statistics.received = _received.load(std::memory_order_relaxed);
+		statistics.published = _published.load(std::memory_order_relaxed);
+		statistics.skipped = _skippedPackets.load(std::memory_order_relaxed);
+		statistics.malformed = _malformed.load(std::memory_order_relaxed);
+		statistics.checksumFailures = _checksumFailures.load(std::memory_order_relaxed);
+		
+		statistics.lost = _lost.load(std::memory_order_relaxed);
+		statistics.reordered = _reordered.load(std::memory_order_relaxed);
+		statistics.duplicates = _duplicates.load(std::memory_order_relaxed);
+		
+		statistics.timeouts = _timeouts.load(std::memory_order_relaxed);
+		statistics.opens = _opens.load(std::memory_order_relaxed);
+		
+		statistics.intervalMean = _arrivalInterval.GetMean();
+		statistics.intervalMedian = _arrivalInterval.GetPercentile(50.0);
+		statistics.interval99 = _arrivalInterval.GetPercentile(99.0);
+		statistics.intervalMax = _arrivalInterval.GetMax();
+		
+		statistics.jitterMean = _arrivalJitter.GetMean();
+		statistics.jitterMedian = _arrivalJitter.GetPercentile(50.0);
+		statistics.jitter99 = _arrivalJitter.GetPercentile(99.0);
+		statistics.jitterMax = _arrivalJitter.GetMax();
+		
+		return statistics;
+	}
+	
+	Navdata *NavdataService::ParseNavdata(const uint8_t *buffer, size_t length, Socket::Timestamp timestamp, NavdataBuffer *source)
+	{
+		const __NavdataRaw *raw = reinterpret_cast<const __NavdataRaw *>(buffer);
+		
+		if(length < sizeof(__NavdataRaw) || raw->header != 0x55667788)
+			return nullptr;
+		
+		SetState(State::Connected);
+		
+		if(raw->sequence <= _sequence)
 		{
-			Open();
-			_opened = true;
+			// This is a missed package that we received out of order
+			return nullptr;
 		}
 		
-		size_t received = 0;
-		Socket::Result result = _socket->Receive(bridge.buffer, 4096, &received);
+		Navdata *navdata = _navdataPool->Acquire();
 		
-		if(result == Socket::Result::Timeout)
+		navdata->state    = raw->state;
+		navdata->sequence = raw->sequence;
+		navdata->vision   = raw->vision;
+		navdata->timestamp = timestamp;
+		
+		if(source)
+			navdata->view = NavdataView(source, length);
+		
+		if(navdata->state & ARDRONE_NAVDATA_BOOTSTRAP)
 		{
-			Open();
-			return;
+			_sequence = navdata->sequence;
+			return navdata;
 		}
 		
-		if(result == Socket::Result::Success && bridge.data.header == 0x55667788)
+		uint8_t *temp = const_cast<uint8_t *>(buffer) + sizeof(__NavdataRaw);
+		size_t left   = length - sizeof(__NavdataRaw);
+		
+		// The checksum covers everything in front of the trailing checksum option. Instead of a second pass over
+		// the datagram it's summed up in windows right behind the walk, while those bytes are still in L1
+		const uint8_t *summed = buffer;
+		uint32_t checksum = 0;
+		
+		bool checksumVerified = false;
+		
+		while(left > sizeof(NavdataOption))
 		{
-			SetState(State::Connected);
-			
-			Navdata *navdata = new Navdata();
+			NavdataOption *option = reinterpret_cast<NavdataOption *>(temp);
 			
-			navdata->state    = bridge.data.state;
-			navdata->sequence = bridge.data.sequence;
-			navdata->vision   = bridge.data.vision;
+			if(option->size < sizeof(NavdataOption) || option->size > left)
+				break;
 			
-			if(navdata->sequence <= _sequence)
+			if(option->tag == NavdataTag::Checksum)
 			{
-				// This is a missed package that we received out of order
-				delete navdata;
-				return;
+				NavdataOptionChecksum *data = static_cast<NavdataOptionChecksum *>(option);
+				
+				// Something follows the checksum option, so the walk doesn't line up with what the drone summed up
+				if(static_cast<size_t>(temp - buffer) == length - sizeof(NavdataOptionChecksum))
+					checksum += Checksum::Sum(summed, temp - summed);
+				else
+					checksum = Checksum::Sum(buffer, length - sizeof(NavdataOptionChecksum));
+				
+				summed = temp;
+				checksumVerified = (checksum == data->checksum);
 			}
-			
-			_sequence = navdata->sequence;
-			
-			
-			if(navdata->state & ARDRONE_NAVDATA_BOOTSTRAP)
+			else if(temp - summed >= kChecksumWindow)
 			{
-				GetDrone()->PublishNavdata(navdata);
-				return;
+				checksum += Checksum::Sum(summed, temp - summed);
+				summed = temp;
 			}
 			
-			uint8_t *temp = bridge.buffer + sizeof(__NavdataRaw);
-			size_t left   = received - sizeof(__NavdataRaw);
-			
-			bool checksumVerified = false;
-			
-			while(left > sizeof(NavdataOption))
+			if(source)
 			{
-				NavdataOption *option = reinterpret_cast<NavdataOption *>(temp);
-				
-				switch(option->tag)
+				// A packet the view can't hold is dropped instead of being indexed partially
+				if(!navdata->view.AddOption(temp - buffer, option->size))
 				{
-					ARNavdataCopyOption(Demo)
-					ARNavdataCopyOption(Time)
-					ARNavdataCopyOption(RawMeasures)
-					ARNavdataCopyOption(PhysMeasures)
-					ARNavdataCopyOption(GyrosOffsets)
-					ARNavdataCopyOption(Trims)
-					ARNavdataCopyOption(RCReferences)
-					ARNavdataCopyOption(PWM)
-					ARNavdataCopyOption(Altitude)
-					ARNavdataCopyOption(VisionRaw)
-					// ARNavdataCopyOption(VisionOf)
-					ARNavdataCopyOption(Vision)
-					ARNavdataCopyOption(VisionPerf)
-					ARNavdataCopyOption(ADCDataFrame)
-					ARNavdataCopyOption(PressureRaw)
-					ARNavdataCopyOption(Magneto)
-					ARNavdataCopyOption(Wind)
-					ARNavdataCopyOption(KalmanPressure)
-					ARNavdataCopyOption(Wifi)
-					ARNavdataCopyOption(GPS)
+					_skippedPackets.fetch_add(1, std::memory_order_relaxed);
 					
-					case NavdataTag::Checksum:
-					{
-						NavdataOptionChecksum *data = static_cast<NavdataOptionChecksum *>(option);
-						navdata->options.emplace_back(new NavdataOptionChecksum(*data));
-						
-						uint32_t checksum = CalculateChecksum(bridge.buffer, received - sizeof(NavdataOptionChecksum));
-						
-						if(checksum == data->checksum)
-							checksumVerified = true;
-					}
-						
-					default:
-						break;
+					navdata->Release();
+					return nullptr;
 				}
 				
+				navdata->IndexOption(option);
+				
 				temp += option->size;
 				left -= option->size;
+				
+				continue;
 			}
 			
-			if(!checksumVerified)
+			switch(option->tag)
 			{
-				std::cout << "Checksum verification failed" << std::endl;
-				return;
+				ARNavdataCopyOption(Demo)
+				ARNavdataCopyOption(Time)
+				ARNavdataCopyOption(RawMeasures)
+				ARNavdataCopyOption(PhysMeasures)
+				ARNavdataCopyOption(GyrosOffsets)
+				ARNavdataCopyOption(Trims)
+				ARNavdataCopyOption(RCReferences)
+				ARNavdataCopyOption(PWM)
+				ARNavdataCopyOption(Altitude)
+				ARNavdataCopyOption(VisionRaw)
+				// ARNavdataCopyOption(VisionOf)
+				ARNavdataCopyOption(Vision)
+				ARNavdataCopyOption(VisionPerf)
+				ARNavdataCopyOption(ADCDataFrame)
+				ARNavdataCopyOption(PressureRaw)
+				ARNavdataCopyOption(Magneto)
+				ARNavdataCopyOption(Wind)
+				ARNavdataCopyOption(KalmanPressure)
+				ARNavdataCopyOption(Wifi)
+				ARNavdataCopyOption(GPS)
+				
+				case NavdataTag::Checksum:
+				{
+					NavdataOptionChecksum *data = static_cast<NavdataOptionChecksum *>(option);
+					navdata->AddOption(new NavdataOptionChecksum(*data));
+					
+					break;
+				}
+					
+				default:
+					break;
 			}
 			
-			GetDrone()->PublishNavdata(navdata);
+			temp += option->size;
+			left -= option->size;
+		}
+		
+		if(!checksumVerified)
+		{
+			std::cout << "Checksum verification failed" << std::endl;
+			_checksumFailures.fetch_add(1, std::memory_order_relaxed);
+			
+			navdata->Release();
+			return nullptr;
+		}
+		
+		_sequence = navdata->sequence;
+		return navdata;
+	}
+	
+	void NavdataService::Tick(uint32_t reason)
+	{
+		if(!_opened)
+		{
+			Open();
+			_opened = true;
+		}
+		
+		Socket::Datagram datagrams[kBatchSize];
+		bool viewMode = _viewMode.load(std::memory_order_relaxed);
+		
+		for(size_t i = 0; i < kBatchSize; i ++)
+		{
+			datagrams[i].data    = viewMode ? _buffers[i]->GetData() : _buffer + (i * kDatagramSize);
+			datagrams[i].maximum = kDatagramSize;
+			datagrams[i].length  = 0;
+		}
+		
+		size_t received = 0;
+		Socket::Result result = _socket->ReceiveBatch(datagrams, kBatchSize, &received);
+		
+		if(result == Socket::Result::Timeout)
+		{
+			_timeouts.fetch_add(1, std::memory_order_relaxed);
+			
+			Open();
+			return;
+		}
+		
+		if(result == Socket::Result::WouldBlock)
+		{
+			// Event driven sockets never time out on their own
+			if(std::chrono::steady_clock::now() - _lastReceive >= std::chrono::seconds(2))
+			{
+				_timeouts.fetch_add(1, std::memory_order_relaxed);
+				Open();
+			}
+			
+			return;
+		}
+		
+		if(result != Socket::Result::Success)
+			return;
+		
+		_lastReceive = std::chrono::steady_clock::now();
+		
+		for(size_t i = 0; i < received; i ++)
+			RecordArrival(reinterpret_cast<const uint8_t *>(datagrams[i].data), datagrams[i].length, datagrams[i].timestamp);
+		
+		// Everything but the newest valid packet of a backlog is stale, so walk the batch backwards
+		// and only fall back to older packets if the newer ones are broken
+		for(size_t i = received; i > 0; i --)
+		{
+			const Socket::Datagram &datagram = datagrams[i - 1];
+			Navdata *navdata = ParseNavdata(reinterpret_cast<const uint8_t *>(datagram.data), datagram.length, datagram.timestamp, viewMode ? _buffers[i - 1] : nullptr);
+			
+			if(navdata)
+			{
+				// The view holds on to the buffer now, so receive into a fresh one from here on
+				if(viewMode)
+				{
+					_buffers[i - 1]->Release();
+					_buffers[i - 1] = _pool->Acquire();
+				}
+				
+				_skippedPackets.fetch_add(i - 1, std::memory_order_relaxed);
+				_published.fetch_add(1, std::memory_order_relaxed);
+				
+				GetDrone()->PublishNavdata(navdata);
+				
+				return;
+			}
 		}
 	}
 }
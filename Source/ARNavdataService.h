@@ -29,6 +29,8 @@
 #include "ARService.h"
 #include "ARSocket.h"
 #include "ARNavdataOptions.h"
+#include "ARNavdataView.h"
+#include "ARHistogram.h"
 
 namespace AR
 {
@@ -49,22 +51,66 @@ namespace AR
 	case NavdataTag::name: \
 	{ \
 		NavdataOption##name *data = static_cast<NavdataOption##name *>(option); \
-		navdata->options.emplace_back(new NavdataOption##name(*data)); \
+		navdata->AddOption(new NavdataOption##name(*data)); \
+		break; \
 	}
 	
 	struct Navdata
 	{
+		friend class Pool<Navdata>;
+		
 		uint32_t state;
 		uint32_t sequence;
 		uint32_t vision;
 		
+		// Time at which the kernel received the datagram
+		std::chrono::steady_clock::time_point timestamp;
+		
+		// Bit n is set if the packet contains the option with tag n
+		uint32_t mask = 0;
+		// Options by tag, the checksum is the only option whose tag doesn't fit
+		NavdataOption *index[32] = {};
+		
+		// Packets are reference counted, a subscriber that wants to keep one past its callback retains it
+		// or holds on to a NavdataRef. The last release hands pooled packets back to their pool
+		void Retain() { _references.fetch_add(1, std::memory_order_relaxed); }
+		void Release()
+		{
+			if(_references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			
+			if(!_pool)
+			{
+				delete this;
+				return;
+			}
+			
+			Reset();
+			_pool->Recycle(this);
+		}
+		
+		// True if all options in tags are present
+		bool HasOptions(uint32_t tags) const { return (mask & tags) == tags; }
+		
 		template<class T>
 		T *GetOptionWithTag(NavdataTag tag)
 		{
+			uint32_t slot = static_cast<uint32_t>(tag);
+			
+			if(slot < 32)
+				return static_cast<T *>(index[slot]);
+			
+			if(view.IsValid())
+				return const_cast<T *>(view.GetOptionWithTag<T>(tag));
+			
+			// Copied options are allocated as their own type, so they are aligned even though NavdataOption is packed
 			for(std::unique_ptr<NavdataOption> &option : options)
 			{
 				if(option->tag == tag)
-					return static_cast<T *>(option.get());
+				{
+					void *data = option.get();
+					return static_cast<T *>(data);
+				}
 			}
 			
 			return nullptr;
@@ -76,12 +122,27 @@ namespace AR
 			navdata->state = state;
 			navdata->sequence = sequence;
 			navdata->vision = vision;
+			navdata->timestamp = timestamp;
+			
+			if(view.IsValid())
+			{
+				navdata->view = view.WithTags(tags);
+				
+				for(uint32_t slot = 0; slot < 32; slot ++)
+				{
+					if((mask & tags) & (UINT32_C(1) << slot))
+						navdata->IndexOption(index[slot]);
+				}
+				
+				return navdata;
+			}
 			
 			for(auto &temp : options)
 			{
 				NavdataOption *option = static_cast<NavdataOption *>(temp.get());
+				uint32_t slot = static_cast<uint32_t>(option->tag);
 				
-				if(!(tags & (UINT32_C(1) << static_cast<uint32_t>(option->tag))))
+				if(slot >= 32 || !(tags & (UINT32_C(1) << slot)))
 					continue;
 				
 				switch(option->tag)
@@ -115,29 +176,192 @@ namespace AR
 			return navdata;
 		}
 		
+		// Takes ownership of the option and indexes it
+		void AddOption(NavdataOption *option)
+		{
+			options.emplace_back(option);
+			IndexOption(option);
+		}
+		
+		// Indexes an option that is owned by someone else, like the buffer behind the view
+		void IndexOption(NavdataOption *option)
+		{
+			uint32_t slot = static_cast<uint32_t>(option->tag);
+			
+			if(slot < 32)
+			{
+				index[slot] = option;
+				mask |= (UINT32_C(1) << slot);
+			}
+		}
+		
+		// Copies of the options, empty if the packet was received in view mode. Options have to
+		// be added through AddOption() to be found by GetOptionWithTag()
 		std::vector<std::unique_ptr<NavdataOption>> options;
+		// Only valid in view mode, the options then stay in the datagram they arrived in
+		NavdataView view;
+		
+	private:
+		void Reset()
+		{
+			for(uint32_t bits = mask; bits; bits &= bits - 1)
+				index[__builtin_ctz(bits)] = nullptr;
+			
+			mask = 0;
+			options.clear();
+			view = NavdataView();
+		}
+		
+		Pool<Navdata> *_pool = nullptr;
+		std::atomic<uint32_t> _references { 1 };
+	};
+	
+	// Keeps a Navdata alive for as long as the handle exists
+	class NavdataRef
+	{
+	public:
+		NavdataRef() :
+			_navdata(nullptr)
+		{}
+		explicit NavdataRef(Navdata *navdata) :
+			_navdata(navdata)
+		{
+			if(_navdata)
+				_navdata->Retain();
+		}
+		NavdataRef(const NavdataRef &other) :
+			NavdataRef(other._navdata)
+		{}
+		NavdataRef(NavdataRef &&other) :
+			_navdata(other._navdata)
+		{
+			other._navdata = nullptr;
+		}
+		~NavdataRef()
+		{
+			if(_navdata)
+				_navdata->Release();
+		}
+		
+		NavdataRef &operator =(NavdataRef other)
+		{
+			std::swap(_navdata, other._navdata);
+			return *this;
+		}
+		
+		Navdata *Get() const { return _navdata; }
+		Navdata *operator ->() const { return _navdata; }
+		Navdata &operator *() const { return *_navdata; }
+		explicit operator bool() const { return _navdata != nullptr; }
+		
+	private:
+		Navdata *_navdata;
 	};
 	
 	class NavdataService : public Service
 	{
 	public:
+		friend class Benchmark;
+		
+		struct Statistics
+		{
+			uint64_t received;
+			uint64_t published;
+			uint64_t skipped; // Valid, but a newer packet arrived in the same batch or the view couldn't hold it
+			uint64_t malformed; // Too short or without the navdata header
+			uint64_t checksumFailures;
+			
+			// From the sequence numbers. A packet counts as lost as soon as a newer one arrives, and stops
+			// counting once it shows up late, as long as it's within the last 64 sequence numbers
+			uint64_t lost;
+			uint64_t reordered;
+			uint64_t duplicates;
+			
+			uint64_t timeouts; // Receives that timed out, or two seconds without navdata when event driven
+			uint64_t opens; // Stream (re)opens, including the first one after connecting
+			
+			// Time between two packets arriving in sequence order
+			std::chrono::nanoseconds intervalMean;
+			std::chrono::nanoseconds intervalMedian;
+			std::chrono::nanoseconds interval99;
+			std::chrono::nanoseconds intervalMax;
+			
+			// Difference between two consecutive intervals, only taken when no packet in between went missing
+			std::chrono::nanoseconds jitterMean;
+			std::chrono::nanoseconds jitterMedian;
+			std::chrono::nanoseconds jitter99;
+			std::chrono::nanoseconds jitterMax;
+		};
+		
 		NavdataService(Drone *drone, const std::string &address);
 		~NavdataService() override;
 		
+		// Number of valid packets that were dropped because a newer packet arrived in the same batch
+		uint64_t GetSkippedPackets() const { return _skippedPackets.load(std::memory_order_relaxed); }
+		
+		// Assembled from relaxed atomics, so the fields are individually but not mutually consistent
+		Statistics GetStatistics() const;
+		const Histogram &GetArrivalInterval() const { return _arrivalInterval; }
+		const Histogram &GetArrivalJitter() const { return _arrivalJitter; }
+		
+		// In view mode packets are received into pooled buffers and Navdata::view indexes the options
+		// in place, instead of every option being copied into its own allocation
+		void SetViewMode(bool enabled) { _viewMode.store(enabled, std::memory_order_relaxed); }
+		bool IsViewMode() const { return _viewMode.load(std::memory_order_relaxed); }
+		
 	protected:
 		void Tick(uint32_t reason) final;
 		
 		State ConnectInternal() final;
 		void DisconnectInternal() final;
 		
+		int GetDescriptor() const final { return _socket->GetDescriptor(); }
+		Socket *GetSocket() const final { return _socket; }
+		
 	private:
+		static constexpr size_t kBatchSize = 16;
+		static constexpr size_t kDatagramSize = NavdataBuffer::kSize;
+		static constexpr ptrdiff_t kChecksumWindow = 512;
+		
 		void Open();
-		uint32_t CalculateChecksum(const uint8_t *data, size_t size) const;
+		// Sequence and timing bookkeeping, only looks at the header so it's done for every datagram of a batch
+		void RecordArrival(const uint8_t *buffer, size_t length, Socket::Timestamp timestamp);
+		// source is the pooled buffer holding the datagram in view mode, nullptr otherwise
+		Navdata *ParseNavdata(const uint8_t *buffer, size_t length, Socket::Timestamp timestamp, NavdataBuffer *source = nullptr);
 		
 		Socket *_socket;
+		uint8_t *_buffer;
+		
+		std::atomic<bool> _viewMode;
+		NavdataBufferPool *_pool;
+		Pool<Navdata> *_navdataPool;
+		NavdataBuffer *_buffers[kBatchSize];
 		
 		bool _opened;		
 		uint32_t _sequence;
+		std::chrono::steady_clock::time_point _lastReceive;
+		
+		std::atomic<uint64_t> _skippedPackets;
+		
+		// Written by the receiving thread only, read without locks by GetStatistics()
+		std::atomic<uint64_t> _received;
+		std::atomic<uint64_t> _published;
+		std::atomic<uint64_t> _malformed;
+		std::atomic<uint64_t> _checksumFailures;
+		std::atomic<uint64_t> _lost;
+		std::atomic<uint64_t> _reordered;
+		std::atomic<uint64_t> _duplicates;
+		std::atomic<uint64_t> _timeouts;
+		std::atomic<uint64_t> _opens;
+		Histogram _arrivalInterval;
+		Histogram _arrivalJitter;
+		
+		// Newest sequence number seen and which of the 64 before it arrived, bit n standing for newest - n
+		uint32_t _firstSequence;
+		uint32_t _newestSequence;
+		uint64_t _sequenceWindow;
+		Socket::Timestamp _lastArrival;
+		std::chrono::nanoseconds _lastInterval;
 	};
 	
 // Just make sure we don't pull this into any scope
@@ -0,0 +1,150 @@
+//
+//  ARNavdataView.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <string.h>
+#include "ARNavdataView.h"
+
+namespace AR
+{
+	NavdataBuffer::NavdataBuffer() :
+		_pool(nullptr),
+		_references(0)
+	{}
+	
+	void NavdataBuffer::Release()
+	{
+		if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			_pool->Recycle(this);
+	}
+	
+	
+	NavdataView::NavdataView() :
+		_buffer(nullptr),
+		_length(0),
+		_count(0)
+	{}
+	
+	NavdataView::NavdataView(NavdataBuffer *buffer, size_t length) :
+		_buffer(buffer),
+		_length(length),
+		_count(0)
+	{
+		_buffer->Retain();
+	}
+	
+	NavdataView::NavdataView(const NavdataView &other) :
+		_buffer(other._buffer),
+		_length(other._length),
+		_count(other._count)
+	{
+		if(_buffer)
+			_buffer->Retain();
+		
+		memcpy(_offsets, other._offsets, _count * sizeof(uint16_t));
+	}
+	
+	NavdataView::NavdataView(NavdataView &&other) :
+		_buffer(other._buffer),
+		_length(other._length),
+		_count(other._count)
+	{
+		memcpy(_offsets, other._offsets, _count * sizeof(uint16_t));
+		
+		other._buffer = nullptr;
+		other._length = 0;
+		other._count  = 0;
+	}
+	
+	NavdataView::~NavdataView()
+	{
+		if(_buffer)
+			_buffer->Release();
+	}
+	
+	NavdataView &NavdataView::operator =(const NavdataView &other)
+	{
+		if(this != &other)
+		{
+			if(other._buffer)
+				other._buffer->Retain();
+			if(_buffer)
+				_buffer->Release();
+			
+			_buffer = other._buffer;
+			_length = other._length;
+			_count  = other._count;
+			
+			memcpy(_offsets, other._offsets, _count * sizeof(uint16_t));
+		}
+		
+		return *this;
+	}
+	
+	NavdataView &NavdataView::operator =(NavdataView &&other)
+	{
+		if(this != &other)
+		{
+			if(_buffer)
+				_buffer->Release();
+			
+			_buffer = other._buffer;
+			_length = other._length;
+			_count  = other._count;
+			
+			memcpy(_offsets, other._offsets, _count * sizeof(uint16_t));
+			
+			other._buffer = nullptr;
+			other._length = 0;
+			other._count  = 0;
+		}
+		
+		return *this;
+	}
+	
+	
+	NavdataView NavdataView::WithTags(uint32_t tags) const
+	{
+		NavdataView view;
+		
+		if(!_buffer)
+			return view;
+		
+		view._buffer = _buffer;
+		view._length = _length;
+		view._buffer->Retain();
+		
+		for(size_t i = 0; i < _count; i ++)
+		{
+			uint32_t tag = static_cast<uint32_t>(GetOption(i)->tag);
+			
+			if(tag < 32 && (tags & (UINT32_C(1) << tag)))
+				view._offsets[view._count ++] = _offsets[i];
+		}
+		
+		return view;
+	}
+	
+	bool NavdataView::AddOption(size_t offset, size_t size)
+	{
+		if(_count == kMaxOptions || offset + size > _length)
+			return false;
+		
+		_offsets[_count ++] = static_cast<uint16_t>(offset);
+		return true;
+	}
+}
@@ -0,0 +1,115 @@
+//
+//  ARNavdataView.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARNavdataView__
+#define __libARDrone__ARNavdataView__
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "ARNavdataOptions.h"
+#include "ARPool.h"
+
+namespace AR
+{
+	class NavdataBuffer;
+	typedef Pool<NavdataBuffer> NavdataBufferPool;
+	
+	// A receive buffer for a single navdata datagram. Buffers are reference counted and go back to
+	// their pool once the last reference is released, which may happen on any thread
+	class NavdataBuffer
+	{
+	public:
+		friend class Pool<NavdataBuffer>;
+		
+		static constexpr size_t kSize = 4096;
+		
+		void Retain() { _references.fetch_add(1, std::memory_order_relaxed); }
+		void Release();
+		
+		uint8_t *GetData() { return _data; }
+		const uint8_t *GetData() const { return _data; }
+		
+	private:
+		NavdataBuffer();
+		
+		NavdataBufferPool *_pool;
+		std::atomic<uint32_t> _references;
+		
+		alignas(64) uint8_t _data[kSize];
+	};
+	
+	// The options of a navdata packet as offsets into the datagram they arrived in, instead of copies.
+	// Views are cheap to copy, every copy keeps the underlying buffer alive. The options are shared
+	// between all copies and must not be modified
+	class NavdataView
+	{
+	public:
+		static constexpr size_t kMaxOptions = 32;
+		
+		NavdataView();
+		NavdataView(NavdataBuffer *buffer, size_t length);
+		NavdataView(const NavdataView &other);
+		NavdataView(NavdataView &&other);
+		~NavdataView();
+		
+		NavdataView &operator =(const NavdataView &other);
+		NavdataView &operator =(NavdataView &&other);
+		
+		bool IsValid() const { return _buffer != nullptr; }
+		
+		const uint8_t *GetData() const { return _buffer ? _buffer->GetData() : nullptr; }
+		size_t GetLength() const { return _length; }
+		
+		size_t GetOptionCount() const { return _count; }
+		const NavdataOption *GetOption(size_t index) const
+		{
+			return reinterpret_cast<const NavdataOption *>(_buffer->GetData() + _offsets[index]);
+		}
+		
+		template<class T>
+		const T *GetOptionWithTag(NavdataTag tag) const
+		{
+			// Cast from the raw bytes, the options are packed and a cast from NavdataOption would be flagged
+			for(size_t i = 0; i < _count; i ++)
+			{
+				if(GetOption(i)->tag == tag)
+					return reinterpret_cast<const T *>(_buffer->GetData() + _offsets[i]);
+			}
+			
+			return nullptr;
+		}
+		
+		// A view of the same datagram that only contains the options in the tags mask
+		NavdataView WithTags(uint32_t tags) const;
+		
+		// Returns false if the table is full or the option runs past the datagram
+		bool AddOption(size_t offset, size_t size);
+		
+	private:
+		NavdataBuffer *_buffer;
+		size_t _length;
+		
+		uint16_t _offsets[kMaxOptions];
+		size_t _count;
+	};
+}
+
+#endif /* defined(__libARDrone__ARNavdataView__) */
@@ -0,0 +1,130 @@
+//
+//  ARPool.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARPool__
+#define __libARDrone__ARPool__
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace AR
+{
+	// Recycles reference counted objects and only allocates while more of them are in flight than
+	// ever before. The pool itself is reference counted by its owner and every outstanding object, so
+	// objects that are still held somewhere keep it alive after its owner is gone.
+	// T has to be default constructible by the pool and carry a Pool<T> *_pool and an
+	// std::atomic<uint32_t> _references, and hand itself to Recycle() once the count drops to zero
+	template<class T>
+	class Pool
+	{
+	public:
+		Pool(size_t reserve) :
+			_count(reserve),
+			_references(1)
+		{
+			_free.reserve(reserve);
+			
+			for(size_t i = 0; i < reserve; i ++)
+				_free.push_back(Create());
+		}
+		
+		// Returns an object with a single reference
+		T *Acquire()
+		{
+			T *object = nullptr;
+			
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				
+				if(!_free.empty())
+				{
+					object = _free.back();
+					_free.pop_back();
+				}
+				else
+				{
+					// Make sure recycling never has to grow the free list
+					_count ++;
+					_free.reserve(_count);
+				}
+			}
+			
+			if(!object)
+				object = Create();
+			
+			object->_references.store(1, std::memory_order_relaxed);
+			_references.fetch_add(1, std::memory_order_relaxed);
+			
+			return object;
+		}
+		
+		void Recycle(T *object)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_free.push_back(object);
+			}
+			
+			Unreference();
+		}
+		
+		// Drops the owner's reference
+		void Release()
+		{
+			Unreference();
+		}
+		
+		size_t GetCount()
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			return _count;
+		}
+		
+	private:
+		~Pool()
+		{
+			for(T *object : _free)
+				delete object;
+		}
+		
+		T *Create()
+		{
+			T *object = new T();
+			object->_pool = this;
+			
+			return object;
+		}
+		
+		void Unreference()
+		{
+			if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
+		
+		std::mutex _lock;
+		std::vector<T *> _free;
+		size_t _count;
+		
+		std::atomic<uint32_t> _references;
+	};
+}
+
+#endif /* defined(__libARDrone__ARPool__) */
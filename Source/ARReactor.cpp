@@ -0,0 +1,311 @@
+//
+//  ARReactor.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <algorithm>
+#include "ARReactor.h"
+#include "ARService.h"
+
+#if __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#define AR_HAS_EPOLL 1
+#endif
+
+namespace AR
+{
+#if AR_HAS_EPOLL
+	Reactor::Reactor() :
+		_descriptor(-1),
+		_stopDescriptor(-1),
+		_running(false)
+	{
+		if((_descriptor = epoll_create1(EPOLL_CLOEXEC)) == -1)
+			return;
+		
+		if((_stopDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		{
+			close(_descriptor);
+			_descriptor = -1;
+			
+			return;
+		}
+		
+		struct epoll_event event;
+		event.events   = EPOLLIN;
+		event.data.ptr = nullptr;
+		
+		epoll_ctl(_descriptor, EPOLL_CTL_ADD, _stopDescriptor, &event);
+		
+		_running = true;
+		_thread  = std::move(std::thread(&Reactor::ThreadHandler, this));
+	}
+	
+	Reactor::~Reactor()
+	{
+		if(_descriptor == -1)
+			return;
+		
+		_running = false;
+		Signal(_stopDescriptor);
+		
+		_thread.join();
+		
+		while(!_registrations.empty())
+			Detach(_registrations.front()->service);
+		
+		close(_stopDescriptor);
+		close(_descriptor);
+	}
+	
+	size_t Reactor::GetServiceCount()
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		return _registrations.size();
+	}
+	
+	
+	void Reactor::Signal(int descriptor)
+	{
+		uint64_t value = 1;
+		ssize_t result = write(descriptor, &value, sizeof(value));
+		(void)result;
+	}
+	
+	void Reactor::Attach(Service *service)
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		
+		std::unique_ptr<Registration> registration(new Registration());
+		registration->service = service;
+		registration->active  = true;
+		registration->pending = 0;
+		
+		registration->socket = { registration.get(), -1, Service::WakeupReason::DataAvilable | Service::WakeupReason::Readable };
+		registration->wakeup = { registration.get(), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), Service::WakeupReason::DataAvilable };
+		registration->timer  = { registration.get(), -1, Service::WakeupReason::Timer };
+		
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		
+		event.data.ptr = &registration->wakeup;
+		epoll_ctl(_descriptor, EPOLL_CTL_ADD, registration->wakeup.descriptor, &event);
+		
+		std::chrono::milliseconds interval = service->_tickInterval;
+		
+		if(interval.count() > 0)
+		{
+			registration->timer.descriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+			
+			struct itimerspec spec;
+			spec.it_interval.tv_sec  = interval.count() / 1000;
+			spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+			spec.it_value = spec.it_interval;
+			
+			timerfd_settime(registration->timer.descriptor, 0, &spec, nullptr);
+			
+			event.data.ptr = &registration->timer;
+			epoll_ctl(_descriptor, EPOLL_CTL_ADD, registration->timer.descriptor, &event);
+		}
+		
+		UpdateSocket(registration.get());
+		
+		{
+			std::lock_guard<std::mutex> serviceLock(service->_mutex);
+			service->_wakeupDescriptor = registration->wakeup.descriptor;
+			service->_wakeup = true;
+		}
+		
+		// Kick off an initial tick, just like a freshly spawned service thread would
+		Signal(registration->wakeup.descriptor);
+		
+		_registrations.push_back(std::move(registration));
+	}
+	
+	void Reactor::Detach(Service *service)
+	{
+		std::lock_guard<std::recursive_mutex> lock(_lock);
+		
+		auto iterator = std::find_if(_registrations.begin(), _registrations.end(), [&](const std::unique_ptr<Registration> &registration) {
+			return registration->service == service;
+		});
+		
+		if(iterator == _registrations.end())
+			return;
+		
+		Registration *registration = iterator->get();
+		registration->active = false;
+		
+		{
+			std::lock_guard<std::mutex> serviceLock(service->_mutex);
+			service->_wakeupDescriptor = -1;
+			service->_wakeup = false;
+		}
+		
+		// The socket might already be closed, in which case the kernel dropped it from the set
+		if(registration->socket.descriptor != -1)
+			epoll_ctl(_descriptor, EPOLL_CTL_DEL, registration->socket.descriptor, nullptr);
+		
+		epoll_ctl(_descriptor, EPOLL_CTL_DEL, registration->wakeup.descriptor, nullptr);
+		close(registration->wakeup.descriptor);
+		
+		if(registration->timer.descriptor != -1)
+		{
+			epoll_ctl(_descriptor, EPOLL_CTL_DEL, registration->timer.descriptor, nullptr);
+			close(registration->timer.descriptor);
+		}
+		
+		// Events for this registration might still be in flight, so keep the memory around until the batch is done
+		_retired.push_back(std::move(*iterator));
+		_registrations.erase(iterator);
+	}
+	
+	
+	void Reactor::UpdateSocket(Registration *registration)
+	{
+		int descriptor = registration->service->GetDescriptor();
+		
+		if(descriptor == registration->socket.descriptor)
+			return;
+		
+		if(registration->socket.descriptor != -1)
+			epoll_ctl(_descriptor, EPOLL_CTL_DEL, registration->socket.descriptor, nullptr);
+		
+		registration->socket.descriptor = descriptor;
+		
+		if(descriptor != -1)
+		{
+			struct epoll_event event;
+			event.events   = EPOLLIN;
+			event.data.ptr = &registration->socket;
+			
+			epoll_ctl(_descriptor, EPOLL_CTL_ADD, descriptor, &event);
+		}
+	}
+	
+	void Reactor::Dispatch(Registration *registration)
+	{
+		Service *service = registration->service;
+		
+		uint32_t reason = registration->pending;
+		registration->pending = 0;
+		
+		service->_reason |= reason;
+		
+		if(service->_reason & Service::WakeupReason::Shutdown)
+			return;
+		
+		service->Tick(service->_reason);
+		service->_reason &= ~(Service::WakeupReason::DataAvilable | Service::WakeupReason::Timer | Service::WakeupReason::Readable);
+		
+		// Services are free to reconnect their socket inside of Tick()
+		if(registration->active)
+			UpdateSocket(registration);
+	}
+	
+	void Reactor::ThreadHandler()
+	{
+		const int kMaxEvents = 64;
+		
+		struct epoll_event events[kMaxEvents];
+		Registration *ready[kMaxEvents];
+		
+		while(_running)
+		{
+			int count = epoll_wait(_descriptor, events, kMaxEvents, -1);
+			
+			if(count == -1)
+			{
+				if(errno == EINTR)
+					continue;
+				
+				break;
+			}
+			
+			std::lock_guard<std::recursive_mutex> lock(_lock);
+			size_t readyCount = 0;
+			
+			for(int i = 0; i < count; i ++)
+			{
+				Source *source = reinterpret_cast<Source *>(events[i].data.ptr);
+				
+				if(!source || !source->registration->active)
+					continue;
+				
+				Registration *registration = source->registration;
+				
+				if(source != &registration->socket)
+				{
+					uint64_t value;
+					ssize_t result = read(source->descriptor, &value, sizeof(value));
+					(void)result;
+				}
+				
+				if(source == &registration->wakeup)
+				{
+					std::lock_guard<std::mutex> serviceLock(registration->service->_mutex);
+					registration->service->_wakeup = false;
+				}
+				
+				if(registration->pending == 0)
+					ready[readyCount ++] = registration;
+				
+				registration->pending |= source->reason;
+			}
+			
+			for(size_t i = 0; i < readyCount; i ++)
+			{
+				if(ready[i]->active)
+					Dispatch(ready[i]);
+			}
+			
+			_retired.clear();
+		}
+	}
+#else
+	Reactor::Reactor() :
+		_descriptor(-1),
+		_stopDescriptor(-1),
+		_running(false)
+	{}
+	
+	Reactor::~Reactor()
+	{}
+	
+	size_t Reactor::GetServiceCount()
+	{
+		return 0;
+	}
+	
+	void Reactor::Signal(int descriptor)
+	{}
+	void Reactor::Attach(Service *service)
+	{}
+	void Reactor::Detach(Service *service)
+	{}
+	void Reactor::Dispatch(Registration *registration)
+	{}
+	void Reactor::UpdateSocket(Registration *registration)
+	{}
+	void Reactor::ThreadHandler()
+	{}
+#endif
+}
@@ -0,0 +1,91 @@
+//
+//  ARReactor.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARReactor__
+#define __libARDrone__ARReactor__
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+
+namespace AR
+{
+	class Service;
+	
+	// A single epoll event loop that can drive the services of any number of drones.
+	// Every attached service gets a wakeup eventfd, a timerfd firing at its tick interval
+	// and, if it has one, its socket. Tick() is only called when one of those fires.
+	// Pass the reactor to the Drone constructor to use it instead of a thread per service,
+	// it has to outlive every drone that uses it.
+	class Reactor
+	{
+	public:
+		friend class Service;
+		
+		Reactor();
+		~Reactor();
+		
+		// Returns false if the platform has no epoll, services then fall back to their own threads
+		bool IsValid() const { return _descriptor != -1; }
+		size_t GetServiceCount();
+		
+	private:
+		struct Registration;
+		
+		struct Source
+		{
+			Registration *registration;
+			int descriptor;
+			uint32_t reason;
+		};
+		
+		struct Registration
+		{
+			Service *service;
+			bool active;
+			uint32_t pending;
+			
+			Source socket;
+			Source wakeup;
+			Source timer;
+		};
+		
+		void Attach(Service *service);
+		void Detach(Service *service);
+		
+		void Dispatch(Registration *registration);
+		void UpdateSocket(Registration *registration);
+		void ThreadHandler();
+		
+		static void Signal(int descriptor);
+		
+		int _descriptor;
+		int _stopDescriptor;
+		std::atomic<bool> _running;
+		
+		std::recursive_mutex _lock;
+		std::thread _thread;
+		
+		std::vector<std::unique_ptr<Registration>> _registrations;
+		std::vector<std::unique_ptr<Registration>> _retired;
+	};
+}
+
+#endif /* defined(__libARDrone__ARReactor__) */
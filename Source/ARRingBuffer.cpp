@@ -0,0 +1,145 @@
+//
+//  ARRingBuffer.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <string.h>
+#include <algorithm>
+#include "ARRingBuffer.h"
+
+namespace AR
+{
+	RingBuffer::RingBuffer(size_t slots) :
+		_tail(0),
+		_head(0)
+	{
+		size_t count = 1;
+		while(count < slots)
+			count <<= 1;
+		
+		_slots = new Slot[count];
+		_mask  = count - 1;
+		
+		for(size_t i = 0; i < count; i ++)
+			_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	
+	RingBuffer::~RingBuffer()
+	{
+		delete [] _slots;
+	}
+	
+	size_t RingBuffer::GetMaxLength() const
+	{
+		return (_mask + 1) * kSlotData - sizeof(uint32_t);
+	}
+	
+	
+	bool RingBuffer::Push(const void *data, size_t length)
+	{
+		if(length > GetMaxLength())
+			return false;
+		
+		// The record is prefixed with its length
+		size_t count = (sizeof(uint32_t) + length + kSlotData - 1) / kSlotData;
+		uint64_t position = _tail.load(std::memory_order_relaxed);
+		
+		while(1)
+		{
+			// Slots are released in order, so if the last slot of the range is free all of them are
+			uint64_t last = position + count - 1;
+			uint64_t sequence = _slots[last & _mask].sequence.load(std::memory_order_acquire);
+			int64_t difference = static_cast<int64_t>(sequence - last);
+			
+			if(difference == 0)
+			{
+				if(_tail.compare_exchange_weak(position, position + count, std::memory_order_relaxed))
+					break;
+			}
+			else if(difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = _tail.load(std::memory_order_relaxed);
+			}
+		}
+		
+		uint32_t header = static_cast<uint32_t>(length);
+		const char *source = reinterpret_cast<const char *>(data);
+		
+		memcpy(_slots[position & _mask].data, &header, sizeof(header));
+		
+		size_t offset = sizeof(header);
+		
+		for(size_t i = 0; i < count; i ++)
+		{
+			size_t copy = std::min(kSlotData - offset, length);
+			
+			memcpy(_slots[(position + i) & _mask].data + offset, source, copy);
+			
+			source += copy;
+			length -= copy;
+			offset  = 0;
+		}
+		
+		// The consumer only looks at the first slot, so publish it last
+		for(size_t i = 1; i < count; i ++)
+			_slots[(position + i) & _mask].sequence.store(position + i + 1, std::memory_order_release);
+		
+		_slots[position & _mask].sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+	
+	bool RingBuffer::IsEmpty() const
+	{
+		return (_slots[_head & _mask].sequence.load(std::memory_order_acquire) != _head + 1);
+	}
+	
+	bool RingBuffer::Pop(std::vector<char> &buffer)
+	{
+		Slot &first = _slots[_head & _mask];
+		
+		if(first.sequence.load(std::memory_order_acquire) != _head + 1)
+			return false;
+		
+		uint32_t length;
+		memcpy(&length, first.data, sizeof(length));
+		
+		size_t count  = (sizeof(uint32_t) + length + kSlotData - 1) / kSlotData;
+		size_t offset = sizeof(uint32_t);
+		size_t left   = length;
+		
+		for(size_t i = 0; i < count; i ++)
+		{
+			Slot &slot = _slots[(_head + i) & _mask];
+			size_t copy = std::min(kSlotData - offset, left);
+			
+			buffer.insert(buffer.end(), slot.data + offset, slot.data + offset + copy);
+			
+			left  -= copy;
+			offset = 0;
+		}
+		
+		// Hand the slots back to the producers one lap later
+		for(size_t i = 0; i < count; i ++)
+			_slots[(_head + i) & _mask].sequence.store(_head + i + _mask + 1, std::memory_order_release);
+		
+		_head += count;
+		return true;
+	}
+}
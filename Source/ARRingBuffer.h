@@ -0,0 +1,68 @@
+//
+//  ARRingBuffer.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARRingBuffer__
+#define __libARDrone__ARRingBuffer__
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace AR
+{
+	// Bounded lock-free queue of variable length records for any number of producers and a single consumer.
+	// A record occupies consecutive 64 byte slots that a producer claims with a single CAS on the tail, so
+	// records never interleave. Every slot carries a sequence number like in Dmitry Vyukov's bounded queue.
+	class RingBuffer
+	{
+	public:
+		// Rounded up to a power of two
+		RingBuffer(size_t slots);
+		~RingBuffer();
+		
+		// Fails if the ring is full
+		bool Push(const void *data, size_t length);
+		
+		// Consumer side only, appends the next record to buffer and returns false if there is none
+		bool Pop(std::vector<char> &buffer);
+		bool IsEmpty() const;
+		
+		size_t GetMaxLength() const;
+		
+	private:
+		static const size_t kSlotData = 56;
+		
+		struct alignas(64) Slot
+		{
+			std::atomic<uint64_t> sequence;
+			char data[kSlotData];
+		};
+		
+		RingBuffer(const RingBuffer &) = delete;
+		RingBuffer &operator =(const RingBuffer &) = delete;
+		
+		Slot *_slots;
+		size_t _mask;
+		
+		alignas(64) std::atomic<uint64_t> _tail;
+		alignas(64) uint64_t _head;
+	};
+}
+
+#endif /* defined(__libARDrone__ARRingBuffer__) */
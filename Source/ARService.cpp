@@ -18,17 +18,21 @@
 
 #include <assert.h>
 #include "ARService.h"
+#include "ARReactor.h"
 #include "ARDrone.h"
 
 namespace AR
 {
 	Service::Service(Drone *drone, const std::string &name) :
 		_drone(drone),
-		_reason(0),
+		_reactor(nullptr),
 		_state(State::Disconnected),
-		_wakeup(false),
 		_name(name),
+		_wakeup(false),
+		_wakeupDescriptor(-1),
+		_tickInterval(10),
 		_canSleep(true),
+		_reason(0),
 		_navdataOptions(0)
 	{}
 	
@@ -44,6 +48,26 @@ namespace AR
 		
 		if(_state == State::Disconnected)
 		{
+			Reactor *reactor = _drone->GetReactor();
+			
+			_reason  = 0;
+			_reactor = (reactor && reactor->IsValid()) ? reactor : nullptr;
+			
+			if(_reactor)
+			{
+				_state = State::Connecting;
+				lock.unlock();
+				
+				_state = ConnectInternal();
+				
+				if(_state == State::Disconnected)
+					_reactor = nullptr;
+				else
+					_reactor->Attach(this);
+				
+				return;
+			}
+			
 			_canTick = false;
 			_thread = std::move(std::thread(&Service::ThreadHandler, this));
 			_state  = State::Connecting;
@@ -63,15 +87,27 @@ namespace AR
 	{
 		std::unique_lock<std::mutex> lock(_mutex);
 		
-		if(_state == State::Connected || _state == State::Connecting)
+		// A service that failed on its own is marked disconnected but still has its thread or reactor slot
+		bool running = (_state == State::Disconnected) && (_thread.joinable() || _reactor);
+		
+		if(_state == State::Connected || _state == State::Connecting || running)
 		{
 			_state = State::Disconnecting;
 			lock.unlock();
 			
-			Wakeup(WakeupReason::Shutdown);
-			_thread.join();
+			if(_reactor)
+			{
+				_reactor->Detach(this);
+			}
+			else
+			{
+				Wakeup(WakeupReason::Shutdown);
+				_thread.join();
+			}
 			
 			DisconnectInternal();
+			
+			_reactor = nullptr;
 			_state = State::Disconnected;
 		}
 	}
@@ -80,6 +116,19 @@ namespace AR
 	void Service::Update()
 	{}
 	
+	void Service::SetSocketOptions(const Socket::Options &options)
+	{
+		Socket *socket = GetSocket();
+		if(socket)
+			socket->SetOptions(options);
+	}
+	
+	Socket::Options Service::GetSocketOptions() const
+	{
+		Socket *socket = GetSocket();
+		return socket ? socket->GetOptions() : Socket::Options();
+	}
+	
 	
 	Service::State Service::ConnectInternal()
 	{
@@ -107,6 +156,11 @@ namespace AR
 		_canTick = true;
 	}
 	
+	void Service::SetTickInterval(std::chrono::milliseconds interval)
+	{
+		_tickInterval = interval;
+	}
+	
 	void Service::SetCanSleep(bool value)
 	{
 		_canSleep = value;
@@ -122,7 +176,11 @@ namespace AR
 		if(!_wakeup)
 		{
 			_wakeup = true;
-			_signal.notify_one();
+			
+			if(_wakeupDescriptor != -1)
+				Reactor::Signal(_wakeupDescriptor);
+			else
+				_signal.notify_one();
 		}
 	}
 	
@@ -136,7 +194,16 @@ namespace AR
 			if(_canSleep)
 			{
 				std::unique_lock<std::mutex> lock(_mutex);
-				_signal.wait_for(lock, std::chrono::milliseconds(10));
+				
+				if(_tickInterval.count() == 0)
+				{
+					_signal.wait(lock, [&]{ return _wakeup; });
+				}
+				else if(!_signal.wait_for(lock, _tickInterval, [&]{ return _wakeup; }))
+				{
+					_reason |= WakeupReason::Timer;
+				}
+				
 				_wakeup = false;
 				lock.unlock();
 			}
@@ -145,7 +212,7 @@ namespace AR
 				return;
 			
 			Tick(_reason);
-			_reason &= ~WakeupReason::DataAvilable;
+			_reason &= ~(WakeupReason::DataAvilable | WakeupReason::Timer);
 		}
 	}
 }
@@ -23,15 +23,19 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <chrono>
 #include <condition_variable>
+#include "ARSocket.h"
 
 namespace AR
 {
 	class Drone;
+	class Reactor;
 	class Service
 	{
 	public:
 		friend class Drone;
+		friend class Reactor;
 		
 		enum class State
 		{
@@ -44,7 +48,9 @@ namespace AR
 		enum WakeupReason
 		{
 			DataAvilable = (1 << 0),
-			Shutdown = (1 << 1)
+			Shutdown = (1 << 1),
+			Timer = (1 << 2),
+			Readable = (1 << 3) // The descriptor of the service became readable, event driven only
 		};
 		
 		Service(Drone *drone, const std::string &name);
@@ -59,6 +65,13 @@ namespace AR
 		const std::string &GetName() const { return _name; }
 		uint32_t GetNavdataOptions() const { return _navdataOptions; }
 		
+		// True if the service is driven by a Reactor instead of its own thread
+		bool IsEventDriven() const { return _reactor != nullptr; }
+		
+		// Overrides the socket profile of the service, takes effect on the next connect
+		void SetSocketOptions(const Socket::Options &options);
+		Socket::Options GetSocketOptions() const;
+		
 	protected:
 		void SetState(State state);
 		Drone *GetDrone() const { return _drone; }
@@ -70,6 +83,12 @@ namespace AR
 		
 		virtual void Update();
 		
+		// Descriptor whose readability should trigger a Tick() when event driven, -1 for none
+		virtual int GetDescriptor() const { return -1; }
+		virtual Socket *GetSocket() const { return nullptr; }
+		
+		// Maximum time between two ticks while idle, zero waits for Wakeup() only
+		void SetTickInterval(std::chrono::milliseconds interval);
 		void SetCanSleep(bool value);
 		void SetCanTick();
 		void UpdateNavdataOptions(uint32_t options);
@@ -78,6 +97,7 @@ namespace AR
 		void ThreadHandler();
 		
 		Drone *_drone;
+		Reactor *_reactor;
 		
 		std::atomic<State> _state;
 		std::atomic<bool> _canTick;
@@ -88,6 +108,8 @@ namespace AR
 		std::thread _thread;
 		
 		bool _wakeup;
+		int _wakeupDescriptor;
+		std::chrono::milliseconds _tickInterval;
 		std::atomic<bool> _canSleep;
 		std::atomic<uint32_t> _reason;
 		
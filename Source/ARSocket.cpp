@@ -17,17 +17,98 @@
 //
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <strings.h>
+#include <string.h>
+#include <algorithm>
+#include <netinet/tcp.h>
 #include "ARSocket.h"
+#include "ARCapture.h"
+
+#if __linux__
+#define AR_HAS_RECVMMSG 1
+#endif
+
+#if defined(SO_TIMESTAMPNS)
+#define AR_TIMESTAMP_OPTION SO_TIMESTAMPNS
+#else
+#define AR_TIMESTAMP_OPTION SO_TIMESTAMP
+#endif
 
 namespace AR
 {
-	Socket::Socket(const std::string &address, uint16_t port, Type type) :
+	union __SocketControl
+	{
+		struct cmsghdr header;
+		uint8_t buffer[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct timeval))];
+	};
+	
+	static Socket::Timestamp ConvertTimestamp(std::chrono::system_clock::duration since)
+	{
+		// The kernel stamps packets with CLOCK_REALTIME, rebase it onto the steady clock by its age
+		auto steady = std::chrono::steady_clock::now();
+		auto age = std::chrono::system_clock::now().time_since_epoch() - since;
+		
+		if(age.count() < 0)
+			return steady;
+		
+		return steady - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+	}
+	
+	static Socket::Timestamp ExtractTimestamp(struct msghdr *message)
+	{
+		for(struct cmsghdr *control = CMSG_FIRSTHDR(message); control; control = CMSG_NXTHDR(message, control))
+		{
+			if(control->cmsg_level != SOL_SOCKET)
+				continue;
+			
+#if defined(SCM_TIMESTAMPNS)
+			if(control->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				struct timespec time;
+				memcpy(&time, CMSG_DATA(control), sizeof(struct timespec));
+				
+				return ConvertTimestamp(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec)));
+			}
+#endif
+			if(control->cmsg_type == SCM_TIMESTAMP)
+			{
+				struct timeval time;
+				memcpy(&time, CMSG_DATA(control), sizeof(struct timeval));
+				
+				return ConvertTimestamp(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(time.tv_sec) + std::chrono::microseconds(time.tv_usec)));
+			}
+		}
+		
+		return std::chrono::steady_clock::now();
+	}
+	
+	
+	Socket::Options::Options() :
+		receiveBufferSize(0),
+		sendBufferSize(0),
+		busyPoll(0),
+		typeOfService(kTOSDefault),
+		noDelay(false),
+		reuseAddress(false),
+		localPort(-1),
+		timeout(std::chrono::seconds(2)),
+		connectTimeout(std::chrono::seconds(2))
+	{}
+	
+	
+	Socket::Socket(const std::string &address, uint16_t port, Type type, const Options &options) :
+		_type(type),
 		_ip(address),
 		_port(port),
 		_socket(-1),
-		_type(type)
+		_blocking(true),
+		_options(options),
+		_capture(nullptr),
+		_replay(nullptr),
+		_replaying(false)
 	{}
 	
 	Socket::~Socket()
@@ -37,6 +118,9 @@ namespace AR
 	
 	bool Socket::Connect()
 	{
+		if((_replaying = (_replay != nullptr)))
+			return true;
+		
 		int type = (_type == Type::UDP) ? SOCK_DGRAM : SOCK_STREAM;
 		int protocol = (_type == Type::UDP) ? IPPROTO_UDP : IPPROTO_TCP;
 		
@@ -46,11 +130,17 @@ namespace AR
 		bzero(&_address, sizeof(struct sockaddr_in));
 		bzero(&_sendAddress, sizeof(struct sockaddr_in));
 		
+		// Buffer sizes have to be in place before the TCP handshake to affect the window
+		ApplyOptions();
 		
 		uint16_t port = _port;
 		
 		if(_type == Type::UDP)
 		{
+			// The drone answers to whatever port we send from, so many drones can share a host with ephemeral ports
+			if(_options.localPort >= 0)
+				port = static_cast<uint16_t>(_options.localPort);
+			
 			_address.sin_family = AF_INET;
 			_address.sin_port   = htons(port);
 			_address.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -79,21 +169,113 @@ namespace AR
 			_sendAddress.sin_port   = _address.sin_port;
 			_sendAddress.sin_addr   = _address.sin_addr;
 			
-			if(connect(_socket, reinterpret_cast<struct sockaddr *>(&_address), sizeof(_address)) == -1)
+			if(!ConnectStream())
 				return false;
 		}
 		
 		
-		struct timeval tv;
-		tv.tv_sec  = 2;
-		tv.tv_usec = 0;
+		if(_options.timeout.count() > 0)
+		{
+			struct timeval tv;
+			tv.tv_sec  = _options.timeout.count() / 1000;
+			tv.tv_usec = (_options.timeout.count() % 1000) * 1000;
+			
+			setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
+			setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+		}
+		
+		int enable = 1;
+		setsockopt(_socket, SOL_SOCKET, AR_TIMESTAMP_OPTION, &enable, sizeof(enable));
+		
+		if(!_blocking)
+			SetBlocking(false);
+		
+		return true;
+	}
+	
+	bool Socket::ConnectStream()
+	{
+		// Connect without blocking so a missing drone costs connectTimeout instead of the kernel's SYN retries
+		int flags = fcntl(_socket, F_GETFL, 0);
+		fcntl(_socket, F_SETFL, flags | O_NONBLOCK);
 		
-		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
-		setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+		if(connect(_socket, reinterpret_cast<struct sockaddr *>(&_address), sizeof(_address)) == -1)
+		{
+			if(errno != EINPROGRESS)
+				return false;
+			
+			struct pollfd descriptor;
+			descriptor.fd = _socket;
+			descriptor.events = POLLOUT;
+			descriptor.revents = 0;
+			
+			auto deadline = std::chrono::steady_clock::now() + _options.connectTimeout;
+			
+			while(1)
+			{
+				auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+				int result = poll(&descriptor, 1, static_cast<int>(std::max<long long>(left.count(), 0)));
+				
+				if(result == -1 && errno == EINTR)
+					continue;
+				if(result <= 0)
+					return false;
+				
+				break;
+			}
+			
+			int error = 0;
+			socklen_t length = sizeof(error);
+			
+			if(getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+				return false;
+		}
 		
+		fcntl(_socket, F_SETFL, flags);
 		return true;
 	}
 	
+	void Socket::ApplyOptions()
+	{
+		if(_options.reuseAddress)
+		{
+			int enable = 1;
+			setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+		}
+		
+		if(_options.receiveBufferSize > 0)
+			setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &_options.receiveBufferSize, sizeof(int));
+		if(_options.sendBufferSize > 0)
+			setsockopt(_socket, SOL_SOCKET, SO_SNDBUF, &_options.sendBufferSize, sizeof(int));
+		
+#if defined(SO_BUSY_POLL)
+		if(_options.busyPoll > 0)
+			setsockopt(_socket, SOL_SOCKET, SO_BUSY_POLL, &_options.busyPoll, sizeof(int));
+#endif
+		
+		if(_options.typeOfService != Options::kTOSDefault)
+			setsockopt(_socket, IPPROTO_IP, IP_TOS, &_options.typeOfService, sizeof(int));
+		
+		if(_type == Type::TCP && _options.noDelay)
+		{
+			int enable = 1;
+			setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+		}
+	}
+	
+	void Socket::SetBlocking(bool blocking)
+	{
+		_blocking = blocking;
+		
+		if(_socket != -1)
+		{
+			int flags = fcntl(_socket, F_GETFL, 0);
+			flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+			
+			fcntl(_socket, F_SETFL, flags);
+		}
+	}
+	
 	void Socket::Disconnect()
 	{
 		if(_socket != -1)
@@ -101,11 +283,32 @@ namespace AR
 			close(_socket);
 			_socket = -1;
 		}
+		
+		_replaying = false;
+	}
+	
+	void Socket::Record(bool sent, const void *data, size_t length, Timestamp timestamp)
+	{
+		Capture *capture = _capture.load(std::memory_order_acquire);
+		
+		if(capture && capture->IsOpen())
+			capture->Record(_port, sent ? Capture::Direction::Sent : Capture::Direction::Received, data, length, timestamp);
+	}
+	
+	void Socket::Record(bool sent, const struct iovec *vectors, size_t count, Timestamp timestamp)
+	{
+		Capture *capture = _capture.load(std::memory_order_acquire);
+		
+		if(capture && capture->IsOpen())
+			capture->Record(_port, sent ? Capture::Direction::Sent : Capture::Direction::Received, vectors, count, timestamp);
 	}
 	
 	
 	Socket::Result Socket::Send(const void *data, size_t length)
 	{
+		if(_replaying)
+			return Result::Success;
+		
 		Result retVal = Result::Success;
 		
 		int error = errno;
@@ -113,65 +316,243 @@ namespace AR
 		ssize_t result = sendto(_socket, data, length, 0, reinterpret_cast<struct sockaddr *>(&_sendAddress), sizeof(_sendAddress));
 		if(result == -1)
 			retVal = Result::BrokenSocket;
+		else
+			Record(true, data, length, std::chrono::steady_clock::now());
 		
 		errno = error;
 		
 		return retVal;
 	}
 	
-	Socket::Result Socket::Receive(void *data, size_t maximum, size_t *actual)
+	Socket::Result Socket::Send(const struct iovec *vectors, size_t count)
 	{
+		if(_replaying)
+			return Result::Success;
+		
 		Result retVal = Result::Success;
 		
 		int error = errno;
 		
-		switch(_type)
+		struct msghdr message;
+		memset(&message, 0, sizeof(struct msghdr));
+		
+		message.msg_name    = &_sendAddress;
+		message.msg_namelen = sizeof(_sendAddress);
+		message.msg_iov     = const_cast<struct iovec *>(vectors);
+		message.msg_iovlen  = count;
+		
+		ssize_t result = sendmsg(_socket, &message, 0);
+		if(result == -1)
+			retVal = Result::BrokenSocket;
+		else
+			Record(true, vectors, count, std::chrono::steady_clock::now());
+		
+		errno = error;
+		
+		return retVal;
+	}
+	
+	Socket::Result Socket::Receive(void *data, size_t maximum, size_t *actual, Timestamp *timestamp)
+	{
+		if(_replaying)
 		{
-			case Type::UDP:
+			Datagram datagram;
+			datagram.data    = data;
+			datagram.maximum = maximum;
+			
+			size_t received;
+			Result result = ReceiveReplay(&datagram, 1, &received);
+			
+			if(result == Result::Success)
 			{
-				struct sockaddr_in temp;
-				socklen_t length = sizeof(_address);
-				
-				ssize_t result = recvfrom(_socket, data, maximum, 0, reinterpret_cast<struct sockaddr *>(&temp), &length);
-				
-				if(result == -1)
-				{
-					retVal = Result::BrokenSocket;
-					
-					if(errno == EAGAIN || errno == EWOULDBLOCK)
-						retVal = Result::Timeout;
-				}
-				else if(actual)
-				{
-					*actual = result;
-				}
-				
-				break;
+				if(actual)
+					*actual = datagram.length;
+				if(timestamp)
+					*timestamp = datagram.timestamp;
 			}
-				
-			case Type::TCP:
+			
+			return result;
+		}
+		
+		Result retVal = Result::Success;
+		
+		int error = errno;
+		
+		struct iovec vector;
+		vector.iov_base = data;
+		vector.iov_len  = maximum;
+		
+		__SocketControl control;
+		
+		struct msghdr message;
+		bzero(&message, sizeof(struct msghdr));
+		
+		message.msg_iov    = &vector;
+		message.msg_iovlen = 1;
+		message.msg_control    = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		
+		ssize_t result = recvmsg(_socket, &message, 0);
+		
+		if(result == -1)
+		{
+			retVal = Result::BrokenSocket;
+			
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				retVal = _blocking ? Result::Timeout : Result::WouldBlock;
+		}
+		else if(result == 0 && _type == Type::TCP && maximum > 0)
+		{
+			// The other side closed the stream
+			retVal = Result::BrokenSocket;
+		}
+		else
+		{
+			Timestamp time = ExtractTimestamp(&message);
+			
+			if(actual)
+				*actual = result;
+			
+			if(timestamp)
+				*timestamp = time;
+			
+			Record(false, data, result, time);
+		}
+		
+		errno = error;
+		return retVal;
+	}
+	
+	Socket::Result Socket::ReceiveBatch(Datagram *datagrams, size_t count, size_t *received)
+	{
+		*received = 0;
+		
+		if(count == 0)
+			return Result::Success;
+		
+		if(_replaying)
+			return ReceiveReplay(datagrams, count, received);
+		
+		if(_type == Type::TCP || count == 1)
+		{
+			Result result = Receive(datagrams[0].data, datagrams[0].maximum, &datagrams[0].length, &datagrams[0].timestamp);
+			
+			if(result == Result::Success)
+				*received = 1;
+			
+			return result;
+		}
+		
+		Result retVal = Result::Success;
+		
+		int error = errno;
+		
+#if AR_HAS_RECVMMSG
+		const size_t kMaxBatch = 64;
+		
+		struct mmsghdr messages[kMaxBatch];
+		struct iovec vectors[kMaxBatch];
+		__SocketControl controls[kMaxBatch];
+		
+		count = std::min(count, kMaxBatch);
+		
+		for(size_t i = 0; i < count; i ++)
+		{
+			vectors[i].iov_base = datagrams[i].data;
+			vectors[i].iov_len  = datagrams[i].maximum;
+			
+			bzero(&messages[i], sizeof(struct mmsghdr));
+			messages[i].msg_hdr.msg_iov    = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+			messages[i].msg_hdr.msg_control    = controls[i].buffer;
+			messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+		}
+		
+		// MSG_WAITFORONE blocks (honouring SO_RCVTIMEO) for the first datagram only
+		int result = recvmmsg(_socket, messages, static_cast<unsigned int>(count), MSG_WAITFORONE, nullptr);
+		
+		if(result == -1)
+		{
+			retVal = Result::BrokenSocket;
+			
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				retVal = _blocking ? Result::Timeout : Result::WouldBlock;
+		}
+		else
+		{
+			for(int i = 0; i < result; i ++)
 			{
-				ssize_t result = recv(_socket, data, maximum, 0);
+				datagrams[i].length    = messages[i].msg_len;
+				datagrams[i].timestamp = ExtractTimestamp(&messages[i].msg_hdr);
 				
-				if(result == -1)
+				Record(false, datagrams[i].data, datagrams[i].length, datagrams[i].timestamp);
+			}
+			
+			*received = result;
+		}
+#else
+		for(size_t i = 0; i < count; i ++)
+		{
+			struct iovec vector;
+			vector.iov_base = datagrams[i].data;
+			vector.iov_len  = datagrams[i].maximum;
+			
+			__SocketControl control;
+			
+			struct msghdr message;
+			bzero(&message, sizeof(struct msghdr));
+			
+			message.msg_iov    = &vector;
+			message.msg_iovlen = 1;
+			message.msg_control    = control.buffer;
+			message.msg_controllen = sizeof(control.buffer);
+			
+			ssize_t result = recvmsg(_socket, &message, (i == 0) ? 0 : MSG_DONTWAIT);
+			
+			if(result == -1)
+			{
+				if(i == 0)
 				{
 					retVal = Result::BrokenSocket;
 					
 					if(errno == EAGAIN || errno == EWOULDBLOCK)
-						retVal = Result::Timeout;
-				}
-				else if(actual)
-				{
-					*actual = result;
+						retVal = _blocking ? Result::Timeout : Result::WouldBlock;
 				}
 				
 				break;
 			}
+			
+			datagrams[i].length    = result;
+			datagrams[i].timestamp = ExtractTimestamp(&message);
+			(*received) ++;
+			
+			Record(false, datagrams[i].data, datagrams[i].length, datagrams[i].timestamp);
 		}
-		
-		
+#endif
 		
 		errno = error;
 		return retVal;
 	}
+	
+	Socket::Result Socket::ReceiveReplay(Datagram *datagrams, size_t count, size_t *received)
+	{
+		*received = 0;
+		
+		// Same semantics as the network path: wait for the first payload, then drain whatever else is due
+		for(size_t i = 0; i < count; i ++)
+		{
+			Result result = _replay->Read(_port, (_type == Type::TCP), datagrams[i].data, datagrams[i].maximum, &datagrams[i].length, (i == 0 && _blocking), _options.timeout);
+			
+			if(result != Result::Success)
+				return (i == 0) ? result : Result::Success;
+			
+			datagrams[i].timestamp = std::chrono::steady_clock::now();
+			(*received) ++;
+			
+			if(_type == Type::TCP)
+				break;
+		}
+		
+		return Result::Success;
+	}
 }
@@ -20,11 +20,17 @@
 #define __libARDrone__ARSocket__
 
 #include <string>
+#include <chrono>
+#include <atomic>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace AR
 {
+	class Capture;
+	class Replay;
+	
 	class Socket
 	{
 	public:
@@ -32,6 +38,7 @@ namespace AR
 		{
 			Success,
 			Timeout,
+			WouldBlock,
 			BrokenSocket
 		};
 		
@@ -41,16 +48,78 @@ namespace AR
 			TCP
 		};
 		
-		Socket(const std::string &address, uint16_t port, Type = Type::UDP);
+		// Kernel arrival time of a received packet, translated into the steady clock
+		typedef std::chrono::steady_clock::time_point Timestamp;
+		
+		struct Datagram
+		{
+			void *data;
+			size_t maximum;
+			size_t length;
+			Timestamp timestamp;
+		};
+		
+		struct Options
+		{
+			Options();
+			
+			// IP_TOS values, the DSCP code point shifted into the upper six bits
+			static const int kTOSDefault   = -1;
+			static const int kTOSBulk      = 0x20; // CS1
+			static const int kTOSVideo     = 0x88; // AF41
+			static const int kTOSExpedited = 0xb8; // EF
+			
+			int receiveBufferSize; // 0 keeps the system default
+			int sendBufferSize;
+			int busyPoll; // Microseconds to busy poll on blocking reads, Linux only
+			int typeOfService;
+			bool noDelay; // TCP only
+			bool reuseAddress; // Lets several sockets, eg. a fleet or a local simulator, bind the same UDP port
+			int localPort; // UDP only, -1 binds the remote port and 0 an ephemeral one
+			
+			std::chrono::milliseconds timeout; // Blocking read and write timeout, zero blocks forever
+			std::chrono::milliseconds connectTimeout; // TCP only
+		};
+		
+		Socket(const std::string &address, uint16_t port, Type = Type::UDP, const Options &options = Options());
 		~Socket();
 		
+		// Takes effect on the next Connect()
+		void SetOptions(const Options &options) { _options = options; }
+		const Options &GetOptions() const { return _options; }
+		
 		bool Connect();
 		void Disconnect();
 		
+		// Non-blocking sockets report Result::WouldBlock instead of waiting for the timeout
+		void SetBlocking(bool blocking);
+		int GetDescriptor() const { return _socket; }
+		
 		Result Send(const void *data, size_t length);
-		Result Receive(void *data, size_t maximum, size_t *actual);
+		// Gathers all vectors into a single datagram
+		Result Send(const struct iovec *vectors, size_t count);
+		Result Receive(void *data, size_t maximum, size_t *actual, Timestamp *timestamp = nullptr);
+		
+		// Blocks until at least one datagram is available and then drains up to count datagrams
+		// without blocking again. Only meaningful for UDP sockets, TCP sockets receive one chunk.
+		Result ReceiveBatch(Datagram *datagrams, size_t count, size_t *received);
+		
+		// Mirrors every payload sent and received into the capture while it is open
+		void SetCapture(Capture *capture) { _capture.store(capture, std::memory_order_release); }
+		// Serves receives from the replay instead of the network and drops all sends. Takes effect on the
+		// next Connect(), replaying sockets have no descriptor and can't be used with a Reactor
+		void SetReplay(Replay *replay) { _replay = replay; }
+		
+		bool IsTapped() const { return (_capture.load(std::memory_order_relaxed) || _replay); }
 		
 	private:
+		bool ConnectStream();
+		void ApplyOptions();
+		
+		void Record(bool sent, const void *data, size_t length, Timestamp timestamp);
+		void Record(bool sent, const struct iovec *vectors, size_t count, Timestamp timestamp);
+		Result ReceiveReplay(Datagram *datagrams, size_t count, size_t *received);
+		
 		Type _type;
 		std::string _ip;
 		uint16_t _port;
@@ -59,6 +128,12 @@ namespace AR
 		struct sockaddr_in _sendAddress;
 		
 		int _socket;
+		bool _blocking;
+		Options _options;
+		
+		std::atomic<Capture *> _capture;
+		Replay *_replay;
+		bool _replaying;
 	};
 }
 
@@ -0,0 +1,505 @@
+//
+//  ARURingReceiver.cpp
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+#include "ARURingReceiver.h"
+
+#if __linux__ && AR_WITH_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define AR_HAS_IO_URING 1
+#endif
+
+namespace AR
+{
+	static std::atomic<bool> __URingDisabled(false);
+	
+#if AR_HAS_IO_URING
+	static int __URingSetup(uint32_t entries, struct io_uring_params *params)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+	}
+	
+	static int __URingEnter(int ring, uint32_t submit, uint32_t wait, uint32_t flags, const void *argument, size_t size)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_enter, ring, submit, wait, flags, argument, size));
+	}
+	
+	static int __URingRegister(int ring, uint32_t opcode, void *argument, uint32_t count)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_register, ring, opcode, argument, count));
+	}
+	
+	// The flexible array in io_uring_buf_ring is wrapped in an empty struct, which isn't empty in C++
+	static struct io_uring_buf *__URingBuffer(void *ring, size_t index)
+	{
+		return reinterpret_cast<struct io_uring_buf *>(ring) + index;
+	}
+	
+	static const uint64_t kReceiveTag = 1;
+	static const uint64_t kCancelTag  = 2;
+#endif
+	
+	URingReceiver::URingReceiver(size_t bufferSize, size_t bufferCount) :
+		_ring(-1),
+		_descriptor(-1),
+		_bufferSize(bufferSize),
+		_bufferCount(1),
+		_buffers(nullptr),
+		_bufferRing(nullptr),
+		_submissionRing(nullptr),
+		_completionRing(nullptr),
+		_entries(nullptr),
+		_armed(false),
+		_pendingSubmit(false),
+		_terminal(Socket::Result::Success),
+		_enterCount(0)
+	{
+		// The kernel wants a power of two
+		while(_bufferCount < bufferCount && _bufferCount < 32768)
+			_bufferCount <<= 1;
+	}
+	
+	URingReceiver::~URingReceiver()
+	{
+		Stop();
+		delete [] _buffers;
+	}
+	
+#if AR_HAS_IO_URING
+	bool URingReceiver::IsSupported()
+	{
+		static bool supported = [] {
+			
+			struct io_uring_params params;
+			memset(&params, 0, sizeof(struct io_uring_params));
+			
+			int ring = __URingSetup(2, &params);
+			if(ring < 0)
+				return false;
+			
+			// Timed waits need EXT_ARG (5.11), provided buffer rings need 5.19 and imply multishot receive support follows closely
+			bool result = (params.features & IORING_FEAT_EXT_ARG);
+			
+			if(result)
+			{
+				void *memory = mmap(nullptr, sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+				
+				struct io_uring_buf_reg reg;
+				memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+				
+				reg.ring_addr    = reinterpret_cast<uint64_t>(memory);
+				reg.ring_entries = 1;
+				
+				result = (memory != MAP_FAILED && __URingRegister(ring, IORING_REGISTER_PBUF_RING, &reg, 1) == 0);
+				
+				if(memory != MAP_FAILED)
+					munmap(memory, sizeof(struct io_uring_buf));
+			}
+			
+			close(ring);
+			return result;
+		}();
+		
+		return supported && !__URingDisabled.load();
+	}
+	
+	bool URingReceiver::Start(int descriptor)
+	{
+		if(_ring != -1)
+			Stop();
+		
+		if(!IsSupported())
+			return false;
+		
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(struct io_uring_params));
+		
+		if((_ring = __URingSetup(8, &params)) < 0)
+		{
+			_ring = -1;
+			return false;
+		}
+		
+		_submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		_completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		_entriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		
+		bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP);
+		
+		if(singleMap)
+			_submissionRingSize = _completionRingSize = std::max(_submissionRingSize, _completionRingSize);
+		
+		_submissionRing = mmap(nullptr, _submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+		_completionRing = singleMap ? _submissionRing : mmap(nullptr, _completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+		_entries = mmap(nullptr, _entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+		
+		if(_submissionRing == MAP_FAILED || _completionRing == MAP_FAILED || _entries == MAP_FAILED)
+		{
+			if(_submissionRing == MAP_FAILED)
+				_submissionRing = nullptr;
+			if(_completionRing == MAP_FAILED)
+				_completionRing = nullptr;
+			if(_entries == MAP_FAILED)
+				_entries = nullptr;
+			
+			Stop();
+			return false;
+		}
+		
+		uint8_t *submission = reinterpret_cast<uint8_t *>(_submissionRing);
+		uint8_t *completion = reinterpret_cast<uint8_t *>(_completionRing);
+		
+		_submissionHead  = reinterpret_cast<uint32_t *>(submission + params.sq_off.head);
+		_submissionTail  = reinterpret_cast<uint32_t *>(submission + params.sq_off.tail);
+		_submissionArray = reinterpret_cast<uint32_t *>(submission + params.sq_off.array);
+		_submissionMask  = *reinterpret_cast<uint32_t *>(submission + params.sq_off.ring_mask);
+		
+		_completionHead = reinterpret_cast<uint32_t *>(completion + params.cq_off.head);
+		_completionTail = reinterpret_cast<uint32_t *>(completion + params.cq_off.tail);
+		_completionMask = *reinterpret_cast<uint32_t *>(completion + params.cq_off.ring_mask);
+		_completions    = completion + params.cq_off.cqes;
+		
+		// Register the receive buffers with the kernel
+		if(!_buffers)
+			_buffers = new uint8_t[_bufferSize * _bufferCount];
+		
+		_bufferRing = mmap(nullptr, _bufferCount * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		
+		if(_bufferRing == MAP_FAILED)
+		{
+			_bufferRing = nullptr;
+			
+			Stop();
+			return false;
+		}
+		
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+		
+		reg.ring_addr    = reinterpret_cast<uint64_t>(_bufferRing);
+		reg.ring_entries = static_cast<uint32_t>(_bufferCount);
+		reg.bgid = 0;
+		
+		if(__URingRegister(_ring, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		{
+			Stop();
+			return false;
+		}
+		
+		struct io_uring_buf_ring *ring = reinterpret_cast<struct io_uring_buf_ring *>(_bufferRing);
+		
+		for(size_t i = 0; i < _bufferCount; i ++)
+		{
+			struct io_uring_buf *buffer = __URingBuffer(_bufferRing, i);
+			
+			buffer->addr = reinterpret_cast<uint64_t>(_buffers + (i * _bufferSize));
+			buffer->len  = static_cast<uint32_t>(_bufferSize);
+			buffer->bid  = static_cast<uint16_t>(i);
+		}
+		
+		_bufferTail = static_cast<uint16_t>(_bufferCount);
+		__atomic_store_n(&ring->tail, _bufferTail, __ATOMIC_RELEASE);
+		
+		_descriptor = descriptor;
+		_armed = false;
+		_pendingSubmit = false;
+		_terminal = Socket::Result::Success;
+		
+		return Arm();
+	}
+	
+	void URingReceiver::Stop()
+	{
+		if(_ring == -1)
+			return;
+		
+		if(_armed && _entries)
+		{
+			// Make sure the kernel is done with the buffers before they go away
+			uint32_t tail = *_submissionTail;
+			uint32_t index = tail & _submissionMask;
+			
+			struct io_uring_sqe *entry = reinterpret_cast<struct io_uring_sqe *>(_entries) + index;
+			memset(entry, 0, sizeof(struct io_uring_sqe));
+			
+			entry->opcode    = IORING_OP_ASYNC_CANCEL;
+			entry->addr      = kReceiveTag;
+			entry->user_data = kCancelTag;
+			
+			_submissionArray[index] = index;
+			__atomic_store_n(_submissionTail, tail + 1, __ATOMIC_RELEASE);
+			
+			int error;
+			Socket::Result result;
+			
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+			uint32_t submit = _pendingSubmit ? 2 : 1;
+			
+			while(_armed && std::chrono::steady_clock::now() < deadline)
+			{
+				Enter(submit, 1, std::chrono::milliseconds(10), &error);
+				Reap(nullptr, &result);
+				
+				submit = 0;
+			}
+		}
+		
+		if(_entries)
+			munmap(_entries, _entriesSize);
+		if(_completionRing && _completionRing != _submissionRing)
+			munmap(_completionRing, _completionRingSize);
+		if(_submissionRing)
+			munmap(_submissionRing, _submissionRingSize);
+		
+		close(_ring);
+		
+		if(_bufferRing)
+			munmap(_bufferRing, _bufferCount * sizeof(struct io_uring_buf));
+		
+		_ring = -1;
+		_descriptor = -1;
+		_armed = false;
+		_pendingSubmit = false;
+		
+		_entries = nullptr;
+		_completionRing = nullptr;
+		_submissionRing = nullptr;
+		_bufferRing = nullptr;
+	}
+	
+	bool URingReceiver::Arm()
+	{
+		uint32_t tail = *_submissionTail;
+		uint32_t index = tail & _submissionMask;
+		
+		struct io_uring_sqe *entry = reinterpret_cast<struct io_uring_sqe *>(_entries) + index;
+		memset(entry, 0, sizeof(struct io_uring_sqe));
+		
+		entry->opcode    = IORING_OP_RECV;
+		entry->fd        = _descriptor;
+		entry->ioprio    = IORING_RECV_MULTISHOT;
+		entry->flags     = IOSQE_BUFFER_SELECT;
+		entry->buf_group = 0;
+		entry->user_data = kReceiveTag;
+		
+		_submissionArray[index] = index;
+		__atomic_store_n(_submissionTail, tail + 1, __ATOMIC_RELEASE);
+		
+		_armed = true;
+		_pendingSubmit = true;
+		
+		return true;
+	}
+	
+	bool URingReceiver::Enter(uint32_t submit, uint32_t wait, std::chrono::milliseconds timeout, int *error)
+	{
+		struct __kernel_timespec time;
+		time.tv_sec  = timeout.count() / 1000;
+		time.tv_nsec = (timeout.count() % 1000) * 1000000;
+		
+		struct io_uring_getevents_arg argument;
+		memset(&argument, 0, sizeof(struct io_uring_getevents_arg));
+		
+		argument.ts = reinterpret_cast<uint64_t>(&time);
+		
+		uint32_t flags = wait ? (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG) : 0;
+		int result = __URingEnter(_ring, submit, wait, flags, wait ? &argument : nullptr, wait ? sizeof(argument) : 0);
+		
+		_enterCount ++;
+		
+		if(result < 0)
+		{
+			*error = errno;
+			return false;
+		}
+		
+		if(submit > 0)
+			_pendingSubmit = false;
+		
+		return true;
+	}
+	
+	size_t URingReceiver::Reap(const Callback *callback, Socket::Result *result)
+	{
+		struct io_uring_buf_ring *ring = reinterpret_cast<struct io_uring_buf_ring *>(_bufferRing);
+		struct io_uring_cqe *completions = reinterpret_cast<struct io_uring_cqe *>(_completions);
+		
+		uint32_t head = *_completionHead;
+		uint32_t tail = __atomic_load_n(_completionTail, __ATOMIC_ACQUIRE);
+		
+		size_t count = 0;
+		bool recycled = false;
+		
+		*result = Socket::Result::Success;
+		
+		while(head != tail)
+		{
+			struct io_uring_cqe *completion = &completions[head & _completionMask];
+			head ++;
+			
+			if(completion->user_data != kReceiveTag)
+				continue;
+			
+			if(!(completion->flags & IORING_CQE_F_MORE))
+				_armed = false;
+			
+			if(completion->res > 0 && (completion->flags & IORING_CQE_F_BUFFER))
+			{
+				uint16_t bid = completion->flags >> IORING_CQE_BUFFER_SHIFT;
+				uint8_t *buffer = _buffers + (bid * _bufferSize);
+				
+				if(callback)
+					(*callback)(buffer, completion->res);
+				
+				// Hand the buffer straight back to the kernel
+				struct io_uring_buf *entry = __URingBuffer(_bufferRing, _bufferTail & (_bufferCount - 1));
+				
+				entry->addr = reinterpret_cast<uint64_t>(buffer);
+				entry->len  = static_cast<uint32_t>(_bufferSize);
+				entry->bid  = bid;
+				
+				_bufferTail ++;
+				recycled = true;
+				
+				count ++;
+			}
+			else if(completion->res == 0)
+			{
+				// The other side closed the stream
+				*result = Socket::Result::BrokenSocket;
+			}
+			else if(completion->res != -ENOBUFS && completion->res != -ECANCELED)
+			{
+				// Kernels without multishot receive reject the request outright
+				if(completion->res == -EINVAL)
+					__URingDisabled = true;
+				
+				*result = Socket::Result::BrokenSocket;
+			}
+		}
+		
+		__atomic_store_n(_completionHead, head, __ATOMIC_RELEASE);
+		
+		if(recycled)
+			__atomic_store_n(&ring->tail, _bufferTail, __ATOMIC_RELEASE);
+		
+		return count;
+	}
+	
+	Socket::Result URingReceiver::Receive(const Callback &callback, std::chrono::milliseconds timeout)
+	{
+		if(_ring == -1)
+			return Socket::Result::BrokenSocket;
+		
+		if(_terminal != Socket::Result::Success)
+		{
+			Socket::Result result = _terminal;
+			_terminal = Socket::Result::Success;
+			
+			return result;
+		}
+		
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		
+		while(1)
+		{
+			Socket::Result result;
+			size_t count = Reap(&callback, &result);
+			
+			if(result != Socket::Result::Success)
+			{
+				// The callback already got the data of this batch, let the caller consume it before the error
+				if(count > 0)
+				{
+					_terminal = result;
+					return Socket::Result::Success;
+				}
+				
+				return result;
+			}
+			
+			// The request terminates once the kernel ran out of buffers, so just arm it again
+			if(!_armed)
+				Arm();
+			
+			int error = 0;
+			
+			if(count > 0)
+			{
+				if(_pendingSubmit)
+					Enter(1, 0, std::chrono::milliseconds(0), &error);
+				
+				return Socket::Result::Success;
+			}
+			
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			if(left.count() <= 0)
+				return Socket::Result::Timeout;
+			
+			if(!Enter(_pendingSubmit ? 1 : 0, 1, left, &error))
+			{
+				if(error == ETIME)
+					return Socket::Result::Timeout;
+				if(error == EINTR || error == EAGAIN || error == EBUSY)
+					continue;
+				
+				return Socket::Result::BrokenSocket;
+			}
+		}
+	}
+#else
+	bool URingReceiver::IsSupported()
+	{
+		return false;
+	}
+	
+	bool URingReceiver::Start(int descriptor)
+	{
+		return false;
+	}
+	
+	void URingReceiver::Stop()
+	{}
+	
+	Socket::Result URingReceiver::Receive(const Callback &callback, std::chrono::milliseconds timeout)
+	{
+		return Socket::Result::BrokenSocket;
+	}
+	
+	bool URingReceiver::Arm()
+	{
+		return false;
+	}
+	
+	bool URingReceiver::Enter(uint32_t submit, uint32_t wait, std::chrono::milliseconds timeout, int *error)
+	{
+		return false;
+	}
+	
+	size_t URingReceiver::Reap(const Callback *callback, Socket::Result *result)
+	{
+		return 0;
+	}
+#endif
+}
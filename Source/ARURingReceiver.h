@@ -0,0 +1,93 @@
+//
+//  ARURingReceiver.h
+//  libARDrone
+//
+//  Created by Sidney Just
+//  Copyright (c) 2014 by Sidney Just
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+//  and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+//  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+//  PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+//  FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+//  ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __libARDrone__ARURingReceiver__
+#define __libARDrone__ARURingReceiver__
+
+#include <chrono>
+#include <functional>
+#include "ARSocket.h"
+
+namespace AR
+{
+	// Receives a stream socket through io_uring. A single multishot recv stays armed on the socket
+	// and the kernel picks receive buffers from a ring of buffers registered up front, so draining
+	// any number of reads costs one io_uring_enter() instead of one recv() each.
+	class URingReceiver
+	{
+	public:
+		typedef std::function<void (const uint8_t *data, size_t length)> Callback;
+		
+		URingReceiver(size_t bufferSize = 32768, size_t bufferCount = 64);
+		~URingReceiver();
+		
+		// False if the library was built without io_uring or the kernel lacks multishot receive
+		static bool IsSupported();
+		
+		bool Start(int descriptor);
+		void Stop();
+		
+		bool IsRunning() const { return _ring != -1; }
+		
+		// Waits up to timeout for data and hands every filled buffer to the callback. When the stream ends or fails
+		// in the same batch as data arrived, the data is returned first and the error on the next call
+		Socket::Result Receive(const Callback &callback, std::chrono::milliseconds timeout);
+		
+		uint64_t GetEnterCount() const { return _enterCount; }
+		
+	private:
+		bool Arm();
+		bool Enter(uint32_t submit, uint32_t wait, std::chrono::milliseconds timeout, int *error);
+		size_t Reap(const Callback *callback, Socket::Result *result);
+		
+		int _ring;
+		int _descriptor;
+		
+		size_t _bufferSize;
+		size_t _bufferCount;
+		uint8_t *_buffers;
+		
+		void *_bufferRing;
+		void *_submissionRing;
+		void *_completionRing;
+		void *_entries;
+		
+		size_t _submissionRingSize;
+		size_t _completionRingSize;
+		size_t _entriesSize;
+		
+		uint32_t *_submissionHead;
+		uint32_t *_submissionTail;
+		uint32_t *_submissionArray;
+		uint32_t _submissionMask;
+		
+		uint32_t *_completionHead;
+		uint32_t *_completionTail;
+		uint32_t _completionMask;
+		void *_completions;
+		
+		uint16_t _bufferTail;
+		bool _armed;
+		bool _pendingSubmit;
+		Socket::Result _terminal;
+		
+		uint64_t _enterCount;
+	};
+}
+
+#endif /* defined(__libARDrone__ARURingReceiver__) */
@@ -22,17 +22,36 @@
 
 namespace AR
 {
+	static Socket::Options VideoSocketOptions()
+	{
+		// Bulk traffic, but with a receive window big enough to hold a couple of I-frames
+		Socket::Options options;
+		options.receiveBufferSize = 1024 * 1024;
+		options.typeOfService = Socket::Options::kTOSBulk;
+		
+		return options;
+	}
+	
 	VideoService::VideoService(Drone *drone) :
 		Service(drone, "Video"),
-		_socket(new Socket(drone->GetDroneIP(), 5555, Socket::Type::TCP))
+		_socket(new Socket(drone->GetDroneIP(), 5555, Socket::Type::TCP, VideoSocketOptions())),
+		_receiver(nullptr),
+		_pendingSize(0)
 	{
 		_bufferSize = 32 * 1024 * 1024;
 		_bufferOffset = 0;
 		_buffer = new uint8_t[_bufferSize]; // Ought to be enough...
+		
+		// Only used to retry broken connections when event driven
+		SetTickInterval(std::chrono::milliseconds(1000));
+		
+		if(URingReceiver::IsSupported())
+			_receiver = new URingReceiver();
 	}
 	
 	VideoService::~VideoService()
 	{
+		delete _receiver;
 		delete _socket;
 		delete [] _buffer;
 	}
@@ -42,17 +61,44 @@ namespace AR
 	Service::State VideoService::ConnectInternal()
 	{
 		_bufferOffset = 0;
+		_timestamps.clear();
 		SetCanSleep(false);
 		
+		_socket->SetBlocking(!IsEventDriven());
+		
 		return (_socket->Connect()) ? Service::State::Connected : Service::State::Disconnected;
 	}
 	
 	void VideoService::DisconnectInternal()
 	{
+		if(_receiver)
+			_receiver->Stop();
+		
 		_socket->Disconnect();
 	}
 	
-	void VideoService::AddVideoDataSubscriber(std::function<void (PAVE *, const uint8_t *)> &&callback, void *token)
+	void VideoService::SetBufferSize(size_t size)
+	{
+		if(GetState() != State::Disconnected || size == _bufferSize)
+			return;
+		
+		delete [] _buffer;
+		
+		_bufferSize = size;
+		_bufferOffset = 0;
+		_buffer = new uint8_t[_bufferSize];
+	}
+	
+	void VideoService::AddVideoDataSubscriber(DataCallback &&callback, void *token)
+	{
+		DataCallback function = std::move(callback);
+		
+		AddVideoFrameSubscriber([function](PAVE *pave, const uint8_t *data, Socket::Timestamp) {
+			function(pave, data);
+		}, token);
+	}
+	
+	void VideoService::AddVideoFrameSubscriber(FrameCallback &&callback, void *token)
 	{
 		std::lock_guard<std::mutex> lock(_mutex);
 		_subscribers.push_back(std::make_pair(std::move(callback), token));
@@ -90,25 +136,59 @@ namespace AR
 		return std::string::npos;
 	}
 	
+	Socket::Timestamp VideoService::GetTimestamp(size_t offset) const
+	{
+		// _timestamps is sorted by offset, find the chunk that contains the byte at offset
+		auto iterator = std::upper_bound(_timestamps.begin(), _timestamps.end(), offset, [](size_t offset, const std::pair<size_t, Socket::Timestamp> &entry) {
+			return offset < entry.first;
+		});
+		
+		if(iterator == _timestamps.begin())
+			return Socket::Timestamp();
+		
+		return (iterator - 1)->second;
+	}
+	
 	void VideoService::Update()
 	{
 		{
-			std::vector<std::vector<uint8_t>> data;
+			std::vector<Chunk> data;
 			
 			{
 				std::lock_guard<std::mutex> lock(_mutex);
 				std::swap(data, _data);
+				
+				_pendingSize = 0;
 			}
 			
 			for(auto &temp : data)
 			{
-				std::copy(temp.data(), temp.data() + temp.size(), _buffer + _bufferOffset);
-				_bufferOffset += temp.size();
+				const uint8_t *bytes = temp.data.data();
+				size_t length = temp.data.size();
+				
+				// An io_uring chunk can be larger than a shrunk buffer, only its tail can still make up a frame
+				if(length > _bufferSize)
+				{
+					bytes += length - _bufferSize;
+					length = _bufferSize;
+				}
+				
+				// Fell too far behind the stream, drop what we have and resync on the next PaVE header
+				if(_bufferOffset + length > _bufferSize)
+				{
+					_bufferOffset = 0;
+					_timestamps.clear();
+				}
+				
+				_timestamps.emplace_back(_bufferOffset, temp.timestamp);
+				
+				std::copy(bytes, bytes + length, _buffer + _bufferOffset);
+				_bufferOffset += length;
 			}
 		}
 		
-		// Get all the frames
-		std::vector<size_t> frames;
+		// Get all the frames, along with the offset at which they end
+		std::vector<std::pair<size_t, size_t>> frames;
 		size_t frameBegin = std::string::npos;
 		
 		while(1)
@@ -127,7 +207,7 @@ namespace AR
 						if(pave->frame_type == PAVEFrameTypeIDRFrame || pave->frame_type == PAVEFrameTypeIFrame)
 							frames.clear();
 						
-						frames.push_back(frameBegin);
+						frames.emplace_back(frameBegin, header - 1);
 					}
 				}
 				
@@ -139,36 +219,101 @@ namespace AR
 		
 		if(frameBegin != std::string::npos)
 		{
-			for(size_t offset : frames)
+			for(auto &frame : frames)
 			{
-				PAVE *pave = reinterpret_cast<PAVE *>(_buffer + offset);
-				const uint8_t *data = _buffer + offset + pave->header_size;
+				PAVE *pave = reinterpret_cast<PAVE *>(_buffer + frame.first);
+				const uint8_t *data = _buffer + frame.first + pave->header_size;
+				Socket::Timestamp timestamp = GetTimestamp(frame.second);
 				
 				for(auto &subscriber : _subscribers)
-					subscriber.first(pave, data);
+					subscriber.first(pave, data, timestamp);
 			}
 			
 			std::copy(_buffer + frameBegin, _buffer + _bufferOffset, _buffer);
 			_bufferOffset = _bufferOffset - frameBegin;
+			
+			// Rebase the chunk timestamps, keeping the chunk that the remaining data starts in
+			Socket::Timestamp first = GetTimestamp(frameBegin);
+			auto iterator = std::remove_if(_timestamps.begin(), _timestamps.end(), [&](const std::pair<size_t, Socket::Timestamp> &entry) {
+				return entry.first <= frameBegin;
+			});
+			
+			_timestamps.erase(iterator, _timestamps.end());
+			
+			for(auto &entry : _timestamps)
+				entry.first -= frameBegin;
+			
+			_timestamps.insert(_timestamps.begin(), std::make_pair(0, first));
 		}
 	}
 	
 	void VideoService::Tick(uint32_t reason)
 	{
-		size_t read = 0;
-		std::vector<uint8_t> buffer(32768);
+		// The reactor already tells us when the socket is readable, io_uring only pays off for the blocking thread.
+		// Captured and replayed sockets have to see every payload, so they bypass it as well
+		bool uring = (_receiver && !IsEventDriven() && !_socket->IsTapped());
 		
-		Socket::Result result = _socket->Receive(buffer.data(), buffer.size(), &read);
+		if(_receiver && !uring && _receiver->IsRunning())
+			_receiver->Stop();
 		
-		if(result == Socket::Result::Success)
+		if(uring && !_receiver->IsRunning() && !_receiver->Start(_socket->GetDescriptor()))
+		{
+			delete _receiver;
+			_receiver = nullptr;
+			
+			uring = false;
+		}
+		
+		Chunk chunk;
+		Socket::Result result;
+		
+		if(uring)
+		{
+			result = _receiver->Receive([&](const uint8_t *data, size_t length) {
+				chunk.data.insert(chunk.data.end(), data, data + length);
+			}, std::chrono::seconds(2));
+			
+			// The completions carry no kernel timestamp
+			chunk.timestamp = std::chrono::steady_clock::now();
+			
+			// A kernel without multishot receive rejects the request, the socket itself is fine
+			if(result == Socket::Result::BrokenSocket && !URingReceiver::IsSupported())
+			{
+				delete _receiver;
+				_receiver = nullptr;
+				
+				uring = false;
+			}
+		}
+		
+		if(!uring)
 		{
-			buffer.resize(read);
+			size_t read = 0;
+			chunk.data.resize(32768);
 			
+			result = _socket->Receive(chunk.data.data(), chunk.data.size(), &read, &chunk.timestamp);
+			chunk.data.resize(read);
+		}
+		
+		if(result == Socket::Result::Success)
+		{
 			std::lock_guard<std::mutex> lock(_mutex);
-			_data.push_back(std::move(buffer));
+			
+			// Nobody called Update() for a while, the backlog would be dropped by it anyway
+			if(_pendingSize + chunk.data.size() > _bufferSize)
+			{
+				_data.clear();
+				_pendingSize = 0;
+			}
+			
+			_pendingSize += chunk.data.size();
+			_data.push_back(std::move(chunk));
 		}
-		else
+		else if(result != Socket::Result::WouldBlock)
 		{
+			if(_receiver)
+				_receiver->Stop();
+			
 			_socket->Disconnect();
 			_bufferOffset = 0;
 			
@@ -24,6 +24,7 @@
 #include <functional>
 #include "ARService.h"
 #include "ARSocket.h"
+#include "ARURingReceiver.h"
 
 namespace AR
 {
@@ -83,33 +84,57 @@ namespace AR
 	class VideoService : public Service
 	{
 	public:
+		friend class Benchmark;
+		
 		VideoService(Drone *drone);
 		~VideoService() override;
 		
-		void AddVideoDataSubscriber(std::function<void (PAVE *, const uint8_t *)> &&callback, void *token);
+		typedef std::function<void (PAVE *, const uint8_t *)> DataCallback;
+		typedef std::function<void (PAVE *, const uint8_t *, Socket::Timestamp)> FrameCallback;
+		
+		void AddVideoDataSubscriber(DataCallback &&callback, void *token);
+		// Like AddVideoDataSubscriber, but also hands out the arrival time of the chunk that completed the frame
+		void AddVideoFrameSubscriber(FrameCallback &&callback, void *token);
 		void RemoveVideoDataSubscriber(void *token);
 		
+		// Bounds the memory of the service to about twice the size, only applied while disconnected
+		void SetBufferSize(size_t size);
+		size_t GetBufferSize() const { return _bufferSize; }
+		
 	protected:
 		void Tick(uint32_t reason) override;
 		State ConnectInternal() override;
 		void DisconnectInternal() override;
 		void Update() override;
 		
+		int GetDescriptor() const override { return _socket->GetDescriptor(); }
+		Socket *GetSocket() const override { return _socket; }
+		
 	private:
+		struct Chunk
+		{
+			std::vector<uint8_t> data;
+			Socket::Timestamp timestamp;
+		};
+		
 		void SendFrame();
+		Socket::Timestamp GetTimestamp(size_t offset) const;
 		void HandleFrame(std::vector<uint8_t> &frame);
 		size_t FindPaveHeader(size_t offset);
 		
 		std::mutex _mutex;
-		std::vector<std::pair<std::function<void (PAVE *, const uint8_t *)>, void *>> _subscribers;
+		std::vector<std::pair<FrameCallback, void *>> _subscribers;
 		
 		Socket *_socket;
+		URingReceiver *_receiver;
 		uint8_t *_buffer;
 		
 		size_t _bufferSize;
 		size_t _bufferOffset;
 		
-		std::vector<std::vector<uint8_t>> _data;
+		std::vector<Chunk> _data;
+		size_t _pendingSize;
+		std::vector<std::pair<size_t, Socket::Timestamp>> _timestamps;
 	};
 }
 